@@ -0,0 +1,88 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) 2016 HHD Software Ltd.
+// Written by Alexander Bessonov
+//
+// Licensed under the MIT license. See LICENSE.txt file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+// Counting replacement of the global allocation functions
+// Every form of operator new is counted in allocations and every operator delete matches one of them, so array, sized
+// and nothrow allocations made by the library or the standard library are neither missed nor freed by the wrong
+// function. The library makes no over-aligned heap allocations, so the aligned forms keep their default definitions.
+// Include in exactly one translation unit of a benchmark program.
+
+#pragma once
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+inline std::atomic<size_t> allocations{ 0 };
+
+namespace counted
+{
+	// kept out of line so that the compiler does not pair malloc/free with the replaced operators
+	[[gnu::noinline]] inline void *allocate(size_t size) noexcept
+	{
+		allocations.fetch_add(1, std::memory_order_relaxed);
+		return std::malloc(size ? size : 1);
+	}
+
+	[[gnu::noinline]] inline void release(void *p) noexcept
+	{
+		std::free(p);
+	}
+}
+
+void *operator new(size_t size)
+{
+	if (auto p = counted::allocate(size))
+		return p;
+	throw std::bad_alloc{};
+}
+
+void *operator new[](size_t size)
+{
+	if (auto p = counted::allocate(size))
+		return p;
+	throw std::bad_alloc{};
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+	return counted::allocate(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+	return counted::allocate(size);
+}
+
+void operator delete(void *p) noexcept
+{
+	counted::release(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+	counted::release(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+	counted::release(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+	counted::release(p);
+}
+
+void operator delete(void *p, const std::nothrow_t &) noexcept
+{
+	counted::release(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept
+{
+	counted::release(p);
+}
@@ -0,0 +1,83 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) 2016 HHD Software Ltd.
+// Written by Alexander Bessonov
+//
+// Licensed under the MIT license. See LICENSE.txt file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+// Registered buffer pool benchmark (Linux only)
+// Reads 16 KiB blocks from a file. Each read is done either into a freshly allocated std::vector with
+// resumable_io_timeout::start, or with resumable_io_timeout::read into a leased buffer that is registered with the kernel.
+//
+// Build (Linux): g++ -std=c++20 -O2 -I../include buffer_pool.cpp -pthread
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <vector>
+
+#include <unistd.h>
+
+#include <cppwinrt_ex/core.h>
+
+namespace
+{
+	using namespace std::chrono_literals;
+
+	constexpr size_t block = 16384;
+	constexpr size_t blocks = 256;
+	constexpr size_t rounds = 40;
+
+	size_t checksum = 0;
+
+	template<class F>
+	void measure(const char *name, F &&f)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < rounds; ++i)
+			f().get();
+		const auto elapsed = std::chrono::steady_clock::now() - start;
+		std::cout << name << ": " << std::chrono::duration<double, std::nano>(elapsed).count() / (rounds * blocks) << " ns/op\n";
+	}
+}
+
+int main()
+{
+	auto file = std::tmpfile();
+	if (!file)
+		return 1;
+	std::vector<char> data(block * blocks, 'x');
+	std::fwrite(data.data(), 1, data.size(), file);
+	std::fflush(file);
+	const int fd = fileno(file);
+
+	winrt_ex::resumable_io_timeout io{ fd };
+	winrt_ex::buffer_pool pool{ block, 4 };
+
+	measure("start() into an allocated buffer", [&]() -> winrt_ex::future<void>
+	{
+		for (size_t i = 0; i < blocks; ++i)
+		{
+			std::vector<std::byte> buffer(block);
+			auto bytes = co_await io.start([&](io_uring_sqe &sqe)
+			{
+				sqe.opcode = IORING_OP_READ;
+				sqe.addr = reinterpret_cast<uintptr_t>(buffer.data());
+				sqe.len = block;
+				sqe.off = i * block;
+			}, 1s);
+			checksum += bytes + static_cast<size_t>(buffer[0]);
+		}
+	});
+
+	measure("read() into a registered buffer", [&]() -> winrt_ex::future<void>
+	{
+		for (size_t i = 0; i < blocks; ++i)
+		{
+			auto lease = co_await io.read(pool, 1s, i * block);
+			checksum += lease.size() + static_cast<size_t>(*lease.data());
+		}
+	});
+
+	std::cout << "(checksum " << checksum << ")\n";
+	std::fclose(file);
+}
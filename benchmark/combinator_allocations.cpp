@@ -0,0 +1,187 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) 2016 HHD Software Ltd.
+// Written by Alexander Bessonov
+//
+// Licensed under the MIT license. See LICENSE.txt file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+// Combinator allocation benchmark
+// Counts calls to global operator new per when_all/when_any call in steady state. Children suspend on a deferred awaiter
+// that is resumed by the benchmark loop, so every child completes asynchronously.
+// future<T> children are attached to the combinator without a coroutine frame; awaiters that only accept a coroutine
+// handle are awaited by a helper coroutine whose frame is recycled by the frame allocator.
+// Measurements with an allocation budget fail the program if they exceed it.
+//
+// Build (Linux): g++ -std=c++20 -O2 -I../include combinator_allocations.cpp -pthread
+// Build (Windows): cl /std:c++latest /O2 /EHsc /I..\include combinator_allocations.cpp
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+#include <cppwinrt_ex/core.h>
+
+#include "allocation_counter.h"
+
+namespace
+{
+	using namespace winrt_ex::details;
+
+	constexpr size_t count = 200'000;
+	constexpr size_t warm_up = 1'000;
+
+	std::vector<coro::coroutine_handle<>> pending;
+
+	// suspends until the benchmark loop resumes it
+	struct deferred
+	{
+		static bool await_ready() noexcept
+		{
+			return false;
+		}
+
+		static void await_suspend(coro::coroutine_handle<> handle)
+		{
+			pending.push_back(handle);
+		}
+
+		static void await_resume() noexcept
+		{
+		}
+	};
+
+	winrt_ex::future<int> child(int value)
+	{
+		co_await deferred{};
+		co_return value;
+	}
+
+	winrt_ex::future<void> void_child()
+	{
+		co_await deferred{};
+	}
+
+	bool failed = false;
+
+	void drain()
+	{
+		while (!pending.empty())
+		{
+			auto handle = pending.back();
+			pending.pop_back();
+			handle.resume();
+		}
+	}
+
+	// budget is the maximum number of allocations per operation, negative for none
+	template<class F>
+	void measure(const char *name, F &&f, double budget = -1)
+	{
+		for (size_t i = 0; i < warm_up; ++i)
+		{
+			f();
+			drain();
+		}
+
+		const auto before = allocations.load(std::memory_order_relaxed);
+		const auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < count; ++i)
+		{
+			f();
+			drain();
+		}
+		const auto elapsed = std::chrono::steady_clock::now() - start;
+		const auto allocated = allocations.load(std::memory_order_relaxed) - before;
+
+		const auto per_op = static_cast<double>(allocated) / count;
+		std::cout << name << ": "
+			<< per_op << " allocations/op, "
+			<< std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() / count << " ns/op\n";
+		if (budget >= 0 && per_op > budget)
+		{
+			std::cout << "FAILED: " << name << " exceeds the budget of " << budget << " allocations/op\n";
+			failed = true;
+		}
+	}
+}
+
+int main()
+{
+	pending.reserve(16);
+
+	measure("3 children awaited in sequence", []
+	{
+		[]() -> winrt_ex::future<void>
+		{
+			co_await child(1);
+			co_await child(2);
+			co_await child(3);
+		}();
+	});
+
+	measure("when_all(future x3)", []
+	{
+		[]() -> winrt_ex::future<void>
+		{
+			co_await winrt_ex::when_all(child(1), child(2), child(3));
+		}();
+	});
+
+	measure("when_all(awaiter x3)", []
+	{
+		[]() -> winrt_ex::future<void>
+		{
+			co_await winrt_ex::when_all(deferred{}, deferred{}, deferred{});
+		}();
+	});
+
+	// the vector of children, the control block with the nodes and the vector of results
+	measure("when_all(vector of 3 futures)", []
+	{
+		[]() -> winrt_ex::future<void>
+		{
+			std::vector<winrt_ex::future<int>> children;
+			children.reserve(3);
+			children.push_back(child(1));
+			children.push_back(child(2));
+			children.push_back(child(3));
+			co_await winrt_ex::when_all(children);
+		}();
+	}, 3);
+
+	// the vector of children and the control block with the nodes
+	measure("when_all(vector of 3 void futures)", []
+	{
+		[]() -> winrt_ex::future<void>
+		{
+			std::vector<winrt_ex::future<void>> children;
+			children.reserve(3);
+			children.push_back(void_child());
+			children.push_back(void_child());
+			children.push_back(void_child());
+			co_await winrt_ex::when_all(children);
+		}();
+	}, 2);
+
+	measure("when_any(future x3)", []
+	{
+		[]() -> winrt_ex::future<void>
+		{
+			co_await winrt_ex::when_any(child(1), child(2), child(3));
+		}();
+	});
+
+	measure("when_any(vector of 3 futures)", []
+	{
+		[]() -> winrt_ex::future<void>
+		{
+			std::vector<winrt_ex::future<int>> children;
+			children.reserve(3);
+			children.push_back(child(1));
+			children.push_back(child(2));
+			children.push_back(child(3));
+			co_await winrt_ex::when_any(std::move(children));
+		}();
+	});
+
+	return failed ? 1 : 0;
+}
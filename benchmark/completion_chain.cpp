@@ -0,0 +1,133 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) 2016 HHD Software Ltd.
+// Written by Alexander Bessonov
+//
+// Licensed under the MIT license. See LICENSE.txt file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+// Completion chain benchmark
+// Builds pipelines of coroutines where every stage awaits the previous one, then completes the first stage. The whole
+// pipeline finishes synchronously inside that single completion, 10 million completions in total. Continuations are
+// resumed by symmetric transfer, so the depth of a pipeline is not limited by the native stack.
+// Awaiting a completed future<T> is compared with awaiting a lazy task<T>.
+//
+// Optimizations are required: symmetric transfer is not a tail call in unoptimized builds of some compilers.
+//
+// Build (Linux): g++ -std=c++20 -O2 -I../include completion_chain.cpp -pthread
+// Build (Windows): cl /std:c++latest /O2 /EHsc /I..\include completion_chain.cpp
+
+#include <chrono>
+#include <iostream>
+
+#include <cppwinrt_ex/core.h>
+
+namespace
+{
+	using namespace winrt_ex::details;
+
+	constexpr size_t depth = 1'000'000;
+	constexpr size_t rounds = 10;
+
+	// suspends until the benchmark resumes it
+	struct trigger
+	{
+		coro::coroutine_handle<> handle;
+
+		struct awaiter
+		{
+			trigger *owner;
+
+			static bool await_ready() noexcept
+			{
+				return false;
+			}
+
+			void await_suspend(coro::coroutine_handle<> handle) noexcept
+			{
+				owner->handle = handle;
+			}
+
+			static void await_resume() noexcept
+			{
+			}
+		};
+
+		awaiter operator co_await() noexcept
+		{
+			return { this };
+		}
+	};
+
+	winrt_ex::future<size_t> source(trigger &t)
+	{
+		co_await t;
+		co_return 0;
+	}
+
+	winrt_ex::future<size_t> stage(winrt_ex::future<size_t> previous)
+	{
+		// a local is released before final suspend, a parameter only together with the frame, which would chain destruction
+		auto input = std::move(previous);
+		co_return co_await input + 1;
+	}
+
+	winrt_ex::future<size_t> ready(size_t value)
+	{
+		co_return value;
+	}
+
+	winrt_ex::task<size_t> lazy(size_t value)
+	{
+		co_return value;
+	}
+
+	template<class F>
+	void measure(const char *name, size_t operations, const F &f)
+	{
+		auto start = std::chrono::steady_clock::now();
+		f();
+		auto stop = std::chrono::steady_clock::now();
+		std::cout << name << ": " << std::chrono::duration<double, std::nano>(stop - start).count() / operations << " ns/op\n";
+	}
+}
+
+int main()
+{
+	measure("pipeline completion", depth * rounds, []
+	{
+		for (size_t r = 0; r < rounds; ++r)
+		{
+			trigger t;
+			auto last = source(t);
+			for (size_t i = 0; i < depth; ++i)
+				last = stage(std::move(last));
+
+			t.handle.resume();
+			if (last.get() != depth)
+				std::terminate();
+		}
+	});
+
+	measure("await completed future", depth * rounds, []
+	{
+		[]() -> winrt_ex::future<void>
+		{
+			size_t sum = 0;
+			for (size_t i = 0; i < depth * rounds; ++i)
+				sum += co_await ready(i);
+			if (sum == 0)
+				std::terminate();
+		}().get();
+	});
+
+	measure("await task", depth * rounds, []
+	{
+		[]() -> winrt_ex::future<void>
+		{
+			size_t sum = 0;
+			for (size_t i = 0; i < depth * rounds; ++i)
+				sum += co_await lazy(i);
+			if (sum == 0)
+				std::terminate();
+		}().get();
+	});
+}
@@ -0,0 +1,148 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) 2016 HHD Software Ltd.
+// Written by Alexander Bessonov
+//
+// Licensed under the MIT license. See LICENSE.txt file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+// Completion state contention benchmark
+// Compares the lock-based promise protocol of version 0.2 with the single atomic state word.
+// Each promise goes through the full life cycle: completion, awaiter registration, final suspend and release.
+// Completion and registration for the same promise are raced on two threads.
+//
+// Build (Linux): g++ -std=c++20 -O2 -I../include future_contention.cpp -pthread
+// Build (Windows): cl /std:c++latest /O2 /EHsc /I..\include future_contention.cpp
+
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <cppwinrt_ex/core.h>
+
+namespace
+{
+	using namespace winrt_ex::details;
+
+	// Version 0.2 protocol: one lock in promise_base0, another one in promise_type_
+	struct legacy_promise
+	{
+		srwlock value_lock;
+		srwlock frame_lock;
+		coro::coroutine_handle<> resume{};
+		status_t status{ status_t::running };
+		bool future_exists{ true };
+		bool final_suspended{ false };
+		int value{};
+
+		void return_value(int v)
+		{
+			std::unique_lock<srwlock> l(value_lock);
+			value = v;
+			status = status_t::ready;
+			if (resume)
+			{
+				l.unlock();
+				resume();
+			}
+		}
+
+		bool start_async(coro::coroutine_handle<> resume_)
+		{
+			const std::lock_guard<srwlock> l(frame_lock);
+			if (status != status_t::running)
+				return false;
+			resume = resume_;
+			return true;
+		}
+
+		void final_suspend()
+		{
+			const std::lock_guard<srwlock> l(frame_lock);
+			final_suspended = future_exists;
+		}
+
+		void destroy()
+		{
+			const std::lock_guard<srwlock> l(frame_lock);
+			future_exists = false;
+		}
+	};
+
+	// Current protocol, driven through the real promise_base<T>
+	struct atomic_promise : promise_base<int>
+	{
+		void final_suspend()
+		{
+			state.fetch_or(final_suspended, std::memory_order_acq_rel);
+		}
+
+		void destroy()
+		{
+			state.fetch_or(future_detached, std::memory_order_acq_rel);
+		}
+	};
+
+	template<class Promise>
+	double run_uncontended(size_t count)
+	{
+		std::vector<Promise> promises(count);
+		auto start = std::chrono::steady_clock::now();
+		for (auto &p : promises)
+		{
+			p.return_value(1);
+			p.start_async(coro::coroutine_handle<>{ coro::noop_coroutine() });
+			p.final_suspend();
+			p.destroy();
+		}
+		auto stop = std::chrono::steady_clock::now();
+		return std::chrono::duration<double, std::nano>(stop - start).count() / count;
+	}
+
+	template<class Promise>
+	double run_contended(size_t count)
+	{
+		std::vector<Promise> promises(count);
+		std::atomic<bool> go{ false };
+
+		auto start = std::chrono::steady_clock::now();
+		std::thread completer{ [&]
+		{
+			while (!go.load(std::memory_order_acquire))
+				std::this_thread::yield();
+			for (auto &p : promises)
+			{
+				p.return_value(1);
+				p.final_suspend();
+			}
+		} };
+		std::thread awaiter{ [&]
+		{
+			go.store(true, std::memory_order_release);
+			for (auto &p : promises)
+			{
+				p.start_async(coro::coroutine_handle<>{ coro::noop_coroutine() });
+				p.destroy();
+			}
+		} };
+		completer.join();
+		awaiter.join();
+		auto stop = std::chrono::steady_clock::now();
+		return std::chrono::duration<double, std::nano>(stop - start).count() / count;
+	}
+
+	template<class F>
+	void measure(const char *name, const F &f)
+	{
+		std::cout << name << ": " << f() << " ns/op\n";
+	}
+}
+
+int main()
+{
+	constexpr size_t count = 2'000'000;
+
+	measure("legacy uncontended", [] { return run_uncontended<legacy_promise>(count); });
+	measure("atomic uncontended", [] { return run_uncontended<atomic_promise>(count); });
+	measure("legacy contended", [] { return run_contended<legacy_promise>(count); });
+	measure("atomic contended", [] { return run_contended<atomic_promise>(count); });
+}
@@ -0,0 +1,84 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) 2016 HHD Software Ltd.
+// Written by Alexander Bessonov
+//
+// Licensed under the MIT license. See LICENSE.txt file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+// Batched I/O submission benchmark (Linux only)
+// Issues groups of small reads from a pipe, each with its own timeout. Every group is either awaited with when_all over
+// separate resumable_io_timeout operations, paying one io_uring_enter per operation, or submitted as one io_batch with
+// a single io_uring_enter.
+//
+// Build (Linux): g++ -std=c++20 -O2 -I../include io_batch.cpp -pthread
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+#include <unistd.h>
+
+#include <cppwinrt_ex/core.h>
+
+namespace
+{
+	using namespace std::chrono_literals;
+
+	constexpr size_t group = 64;
+	constexpr size_t rounds = 2'000;
+
+	char buffer[group];
+
+	auto read_one(char *target)
+	{
+		return [target](io_uring_sqe &sqe)
+		{
+			sqe.opcode = IORING_OP_READ;
+			sqe.addr = reinterpret_cast<uintptr_t>(target);
+			sqe.len = 1;
+		};
+	}
+
+	template<class F>
+	void measure(const char *name, int write_fd, F &&f)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < rounds; ++i)
+		{
+			if (write(write_fd, buffer, group) != static_cast<ssize_t>(group))
+				throw std::runtime_error("write failed");
+			f().get();
+		}
+		const auto elapsed = std::chrono::steady_clock::now() - start;
+		std::cout << name << ": " << std::chrono::duration<double, std::nano>(elapsed).count() / (rounds * group) << " ns/op\n";
+	}
+}
+
+int main()
+{
+	int fds[2];
+	if (pipe(fds))
+		return 1;
+
+	winrt_ex::resumable_io_timeout io{ fds[0] };
+
+	measure("when_all of separate operations", fds[1], [&]() -> winrt_ex::future<void>
+	{
+		std::vector<decltype(io.start(read_one(buffer), 1s))> operations;
+		operations.reserve(group);
+		for (size_t i = 0; i < group; ++i)
+			operations.push_back(io.start(read_one(buffer + i), 1s));
+		co_await winrt_ex::when_all(operations);
+	});
+
+	measure("io_batch", fds[1], [&]() -> winrt_ex::future<void>
+	{
+		winrt_ex::io_batch batch;
+		batch.reserve(group);
+		for (size_t i = 0; i < group; ++i)
+			batch.add(io, read_one(buffer + i), 1s);
+		co_await batch;
+	});
+
+	close(fds[0]);
+	close(fds[1]);
+}
@@ -0,0 +1,383 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) 2016 HHD Software Ltd.
+// Written by Alexander Bessonov
+//
+// Licensed under the MIT license. See LICENSE.txt file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+// Benchmark suite for the coroutine primitives
+// Every benchmark is calibrated until a run takes at least the minimum time and reports the cost of one operation in
+// nanoseconds and in calls to global operator new. Suspended children are resumed by the benchmark loop, so the numbers
+// contain the library's own cost only.
+//
+// Usage: suite [--json] [--filter <substring>] [--min-time <milliseconds>]
+// --json prints one JSON document for tracking regressions between versions.
+//
+// Build (Linux): g++ -std=c++20 -O2 -I../include suite.cpp -pthread
+// Build (Windows): cl /std:c++latest /O2 /EHsc /I..\include suite.cpp
+// Or build all benchmarks with CMake from the repository root.
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cppwinrt_ex/core.h>
+
+#include "allocation_counter.h"
+
+namespace
+{
+	using namespace winrt_ex::details;
+	using clock = std::chrono::steady_clock;
+
+	struct options
+	{
+		bool json = false;
+		std::string filter;
+		std::chrono::milliseconds min_time{ 200 };
+	};
+
+	struct result
+	{
+		std::string name;
+		size_t iterations;
+		double ns_per_op;
+		double allocations_per_op;
+	};
+
+	// suspends until the benchmark loop resumes it
+	std::vector<coro::coroutine_handle<>> pending;
+
+	struct deferred
+	{
+		static bool await_ready() noexcept
+		{
+			return false;
+		}
+
+		static void await_suspend(coro::coroutine_handle<> handle)
+		{
+			pending.push_back(handle);
+		}
+
+		static void await_resume() noexcept
+		{
+		}
+	};
+
+	void drain()
+	{
+		// resumed coroutines may defer again, so do not iterate over the vector directly; both vectors keep their capacity
+		static std::vector<coro::coroutine_handle<>> batch;
+		while (!pending.empty())
+		{
+			batch.swap(pending);
+			for (auto handle : batch)
+				handle.resume();
+			batch.clear();
+		}
+	}
+
+	future<int> ready_child(int value)
+	{
+		co_return value;
+	}
+
+	future<int> suspended_child(int value)
+	{
+		co_await deferred{};
+		co_return value;
+	}
+
+	task<int> ready_task(int value)
+	{
+		co_return value;
+	}
+
+	// runs f(iterations), doubling the number of iterations until a run takes at least min_time
+	template<class F>
+	result run(const options &opts, const std::string &name, F &&f)
+	{
+		size_t iterations = 1;
+		for (;;)
+		{
+			const auto allocations_before = allocations.load(std::memory_order_relaxed);
+			const auto start = clock::now();
+			f(iterations);
+			const auto elapsed = clock::now() - start;
+			const auto allocated = allocations.load(std::memory_order_relaxed) - allocations_before;
+
+			if (elapsed >= opts.min_time || iterations >= (size_t{ 1 } << 40))
+			{
+				return { name, iterations,
+					std::chrono::duration<double, std::nano>(elapsed).count() / iterations,
+					static_cast<double>(allocated) / iterations };
+			}
+			iterations *= 2;
+		}
+	}
+
+	class suite
+	{
+		options opts;
+		std::vector<result> results;
+
+	public:
+		explicit suite(options opts) :
+			opts{ std::move(opts) }
+		{}
+
+		template<class F>
+		void add(const std::string &name, F &&f)
+		{
+			if (!opts.filter.empty() && name.find(opts.filter) == std::string::npos)
+				return;
+			// warm up the frame allocator and the caches
+			f(16);
+			results.push_back(run(opts, name, std::forward<F>(f)));
+			if (!opts.json)
+			{
+				const auto &r = results.back();
+				std::cout << r.name << ": " << r.ns_per_op << " ns/op, " << r.allocations_per_op << " allocations/op (" << r.iterations << " iterations)" << std::endl;
+			}
+		}
+
+		void print_json() const
+		{
+			std::cout << "{\n  \"library\": \"cppwinrt_ex\",\n  \"version\": \"0.3\",\n  \"benchmarks\": [";
+			const char *separator = "\n";
+			for (const auto &r : results)
+			{
+				std::cout << separator << "    { \"name\": \"" << r.name << "\", \"iterations\": " << r.iterations
+					<< ", \"ns_per_op\": " << r.ns_per_op << ", \"allocations_per_op\": " << r.allocations_per_op << " }";
+				separator = ",\n";
+			}
+			std::cout << "\n  ]\n}\n";
+		}
+	};
+
+	void future_benchmarks(suite &s)
+	{
+		s.add("future/create+complete+await ready", [](size_t n)
+		{
+			[](size_t n) -> future<void>
+			{
+				for (size_t i = 0; i < n; ++i)
+					co_await ready_child(static_cast<int>(i));
+			}(n).get();
+		});
+
+		s.add("future/create+complete+await suspended", [](size_t n)
+		{
+			auto parent = [](size_t n) -> future<void>
+			{
+				for (size_t i = 0; i < n; ++i)
+					co_await suspended_child(static_cast<int>(i));
+			}(n);
+			drain();
+			parent.get();
+		});
+
+		s.add("future/create+complete+get", [](size_t n)
+		{
+			for (size_t i = 0; i < n; ++i)
+				ready_child(static_cast<int>(i)).get();
+		});
+
+		s.add("task/create+await", [](size_t n)
+		{
+			[](size_t n) -> future<void>
+			{
+				for (size_t i = 0; i < n; ++i)
+					co_await ready_task(static_cast<int>(i));
+			}(n).get();
+		});
+	}
+
+	template<class Combinator>
+	void fan_out(suite &s, const char *name, size_t children, Combinator combinator)
+	{
+		s.add(std::string{ name } + "/" + std::to_string(children) + " children", [=](size_t n)
+		{
+			std::vector<future<int>> futures;
+			futures.reserve(children);
+			for (size_t i = 0; i < n; ++i)
+			{
+				futures.clear();
+				for (size_t c = 0; c < children; ++c)
+					futures.push_back(suspended_child(static_cast<int>(c)));
+				auto parent = combinator(futures);
+				drain();
+				parent.get();
+			}
+		});
+	}
+
+	void combinator_benchmarks(suite &s)
+	{
+		for (size_t children : { size_t{ 2 }, size_t{ 16 }, size_t{ 1'000 }, size_t{ 100'000 } })
+		{
+			fan_out(s, "when_all", children, [](std::vector<future<int>> &futures) -> future<void>
+			{
+				co_await when_all(futures);
+			});
+
+			fan_out(s, "when_any", children, [](std::vector<future<int>> &futures) -> future<void>
+			{
+				co_await when_any(std::move(futures));
+			});
+		}
+
+		for (size_t max_concurrency : { size_t{ 0 }, size_t{ 64 } })
+		{
+			s.add("task_group/spawn+join, max_concurrency " + std::to_string(max_concurrency), [=](size_t n)
+			{
+				auto parent = [](size_t n, size_t max_concurrency) -> future<void>
+				{
+					task_group group{ max_concurrency };
+					for (size_t i = 0; i < n; ++i)
+						co_await group.spawn(suspended_child(static_cast<int>(i)));
+					co_await group.join();
+				}(n, max_concurrency);
+				drain();
+				parent.get();
+			});
+		}
+	}
+
+	void timer_benchmarks(suite &s)
+	{
+		s.add("timer_wheel/arm+cancel", [](size_t n)
+		{
+			timer_wheel::timer timer{ [](void *) noexcept {}, nullptr };
+			for (size_t i = 0; i < n; ++i)
+			{
+				timer.set(std::chrono::seconds{ 10 + i % 10'000 });
+				timer.cancel();
+			}
+		});
+
+		s.add("async_timer/wait+cancel", [](size_t n)
+		{
+			async_timer timer;
+			for (size_t i = 0; i < n; ++i)
+			{
+				auto waiting = start_async(timer.wait(std::chrono::seconds{ 10 }));
+				timer.cancel();
+				try
+				{
+					waiting.get();
+				}
+				catch (...)
+				{
+				}
+			}
+		});
+	}
+
+	// One coroutine migrates between two threads: each side publishes its handle and the other side, spinning, resumes
+	// it. An operation is one resumption on the other thread, so ns/op is the one-way latency. Spinning threads yield
+	// after a while, so the benchmark still makes progress on a single core.
+	void cross_thread_benchmarks(suite &s)
+	{
+		s.add("cross-thread resume latency", [](size_t n)
+		{
+			std::atomic<void *> slot[2]{};
+			std::atomic<bool> stop{ false };
+
+			struct hand_over
+			{
+				std::atomic<void *> &target;
+
+				static bool await_ready() noexcept
+				{
+					return false;
+				}
+
+				void await_suspend(coro::coroutine_handle<> handle) noexcept
+				{
+					target.store(handle.address(), std::memory_order_release);
+				}
+
+				static void await_resume() noexcept
+				{
+				}
+			};
+
+			auto worker = [&](std::atomic<void *> &mine)
+			{
+				unsigned spins = 0;
+				while (!stop.load(std::memory_order_acquire))
+				{
+					if (auto address = mine.exchange(nullptr, std::memory_order_acquire))
+					{
+						spins = 0;
+						coro::coroutine_handle<>::from_address(address).resume();
+					}
+					else if (++spins < 1024)
+						cpu_relax();
+					else
+						std::this_thread::yield();
+				}
+			};
+
+			std::thread a{ worker, std::ref(slot[0]) };
+			std::thread b{ worker, std::ref(slot[1]) };
+
+			auto migrating = [](size_t n, std::atomic<void *> *slot) -> future<void>
+			{
+				for (size_t i = 0; i < n; ++i)
+					co_await hand_over{ slot[i & 1] };
+			}(n, slot);
+			migrating.wait();
+
+			stop.store(true, std::memory_order_release);
+			a.join();
+			b.join();
+		});
+
+		s.add("thread_pool/schedule", [](size_t n)
+		{
+			[](size_t n) -> future<void>
+			{
+				auto &pool = thread_pool::get_default();
+				for (size_t i = 0; i < n; ++i)
+					co_await pool.schedule();
+			}(n).get();
+		});
+	}
+}
+
+int main(int argc, char **argv)
+{
+	options opts;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (!std::strcmp(argv[i], "--json"))
+			opts.json = true;
+		else if (!std::strcmp(argv[i], "--filter") && i + 1 < argc)
+			opts.filter = argv[++i];
+		else if (!std::strcmp(argv[i], "--min-time") && i + 1 < argc)
+			opts.min_time = std::chrono::milliseconds{ std::atoi(argv[++i]) };
+		else
+		{
+			std::cerr << "usage: " << argv[0] << " [--json] [--filter <substring>] [--min-time <milliseconds>]\n";
+			return 1;
+		}
+	}
+
+	pending.reserve(1024);
+
+	suite s{ opts };
+	future_benchmarks(s);
+	combinator_benchmarks(s);
+	timer_benchmarks(s);
+	cross_thread_benchmarks(s);
+
+	if (opts.json)
+		s.print_json();
+}
@@ -0,0 +1,97 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) 2016 HHD Software Ltd.
+// Written by Alexander Bessonov
+//
+// Licensed under the MIT license. See LICENSE.txt file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+// Timer arm/cancel benchmark
+// Arms one million timers with idle-timeout-like durations and cancels them again, the way connection timeouts behave.
+// On Windows, the same is measured with one thread pool timer per connection for comparison.
+//
+// Build (Linux): g++ -std=c++20 -O2 -I../include timer_wheel.cpp -pthread
+// Build (Windows): cl /std:c++latest /O2 /EHsc /I..\include timer_wheel.cpp
+
+#include <chrono>
+#include <deque>
+#include <iostream>
+
+#include <cppwinrt_ex/core.h>
+
+namespace
+{
+	using namespace std::chrono_literals;
+	using winrt_ex::details::TimeSpan;
+
+	constexpr size_t count = 1'000'000;
+
+	void noop(void *) noexcept
+	{
+	}
+
+	template<class F>
+	void measure(const char *name, size_t operations, const F &f)
+	{
+		auto start = std::chrono::steady_clock::now();
+		f();
+		auto stop = std::chrono::steady_clock::now();
+		std::cout << name << ": " << std::chrono::duration<double, std::nano>(stop - start).count() / operations << " ns/op\n";
+	}
+
+	TimeSpan get_timeout(size_t i)
+	{
+		// spread over all wheel levels: 10 seconds to ~3 hours
+		return std::chrono::seconds{ 10 + i % 10'000 };
+	}
+}
+
+int main()
+{
+	{
+		std::deque<winrt_ex::timer_wheel::timer> timers;
+		for (size_t i = 0; i < count; ++i)
+			timers.emplace_back(noop, nullptr);
+
+		measure("timer_wheel arm", count, [&]
+		{
+			for (size_t i = 0; i < count; ++i)
+				timers[i].set(get_timeout(i));
+		});
+
+		measure("timer_wheel re-arm", count, [&]
+		{
+			for (size_t i = 0; i < count; ++i)
+				timers[i].set(get_timeout(i + 1));
+		});
+
+		measure("timer_wheel cancel", count, [&]
+		{
+			for (size_t i = 0; i < count; ++i)
+				timers[i].cancel();
+		});
+	}
+
+	measure("timer_wheel create+arm+cancel", count, []
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			winrt_ex::timer_wheel::timer timer{ noop, nullptr };
+			timer.set(get_timeout(i));
+			timer.cancel();
+		}
+	});
+
+#if defined(_WIN32)
+	measure("thread pool timer create+arm+cancel", count, []
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			auto timer = CreateThreadpoolTimer([](PTP_CALLBACK_INSTANCE, void *, PTP_TIMER) noexcept {}, nullptr, nullptr);
+			int64_t relative_count = -get_timeout(i).count();
+			SetThreadpoolTimer(timer, reinterpret_cast<PFILETIME>(&relative_count), 0, 0);
+			SetThreadpoolTimer(timer, nullptr, 0, 0);
+			WaitForThreadpoolTimerCallbacks(timer, TRUE);
+			CloseThreadpoolTimer(timer);
+		}
+	});
+#endif
+}
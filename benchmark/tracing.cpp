@@ -0,0 +1,68 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) 2016 HHD Software Ltd.
+// Written by Alexander Bessonov
+//
+// Licensed under the MIT license. See LICENSE.txt file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+// Lifecycle tracing benchmark
+// Measures the cost of recording one trace event and of a traced future<T> that is created, completed and awaited (four
+// events). Compare the second number with "future/create+complete+await ready" of the suite, which is built without
+// tracing. Pass a file name to also write the recorded events in Chrome trace format.
+//
+// Build (Linux): g++ -std=c++20 -O2 -I../include tracing.cpp -pthread
+// Build (Windows): cl /std:c++latest /O2 /EHsc /I..\include tracing.cpp
+
+#define CPPWINRT_EX_ENABLE_TRACING
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+
+#include <cppwinrt_ex/core.h>
+
+namespace
+{
+	using namespace winrt_ex::details;
+
+	constexpr size_t count = 10'000'000;
+
+	template<class F>
+	void measure(const char *name, F &&f)
+	{
+		f(count / 10);
+
+		const auto start = std::chrono::steady_clock::now();
+		f(count);
+		const auto elapsed = std::chrono::steady_clock::now() - start;
+		std::cout << name << ": " << std::chrono::duration<double, std::nano>(elapsed).count() / count << " ns/op\n";
+	}
+
+	winrt_ex::future<int> ready_child(int value)
+	{
+		co_return value;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	measure("trace event", [](size_t n)
+	{
+		for (size_t i = 0; i < n; ++i)
+			trace(trace_event::timer_armed, &n, static_cast<uint32_t>(i));
+	});
+
+	measure("traced future create+complete+await", [](size_t n)
+	{
+		[](size_t n) -> winrt_ex::future<void>
+		{
+			for (size_t i = 0; i < n; ++i)
+				co_await ready_child(static_cast<int>(i));
+		}(n).get();
+	});
+
+	if (argc > 1)
+	{
+		std::ofstream out{ argv[1] };
+		winrt_ex::write_chrome_trace(out);
+	}
+}
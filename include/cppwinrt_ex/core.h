@@ -7,26 +7,246 @@
 // Version 0.2
 // async_action & async_operation<T> classes removed
 // light-weight future<T> template added
+//
+// Version 0.3
+// future<T> completion uses a single atomic state word instead of locks
+// future<T>, when_all, when_any and start_async build with standard C++20 coroutines on non-Windows platforms
+// future<T> coroutine frames are recycled through per-thread free lists, std::allocator_arg_t form added
+// io_uring based resumable_io_timeout on Linux
+// async_timer, supports_timeout and execute_with_timeout share a hierarchical timer wheel (opt-in on Windows with CPPWINRT_EX_USE_TIMER_WHEEL)
+// when_all over a range of awaitables
+// when_all and when_any drive child awaiters directly, without a helper coroutine per child
+// cancellation_source/cancellation_token; when_any and execute_with_timeout cancel losing operations
+// when_any uses a single intrusively counted block, when_any over a range of awaitables
+// work-stealing thread_pool with schedule()/resume_on and pool_policy for start<Policy>
+// future<T>::wait/get block on the promise state word (futex/WaitOnAddress), wait_for/wait_until added
+// continuations of future<T> and combinator children are resumed by symmetric transfer from final_suspend
+// lazy move-only task<T>
+// shared_future<T> with a lock-free list of awaiters, future<T>::share()
+// future<T> results are constructed in place, T may be move-only and non-default-constructible
+// expected<T>, try_await and try_execute_with_timeout report timeouts, cancellation and I/O errors without exceptions
+// async_generator<T> with backpressure and optional prefetch depth
+// io_batch submits several resumable_io_timeout operations with one io_uring_enter
+// buffer_pool of kernel-registered buffers, resumable_io_timeout::read produces a buffer_lease
+// bounded lock-free MPMC async_channel<T>
+// async_event, async_mutex and async_semaphore with lock-free waiter lists
+// CMake build of benchmarks, benchmark/suite.cpp with JSON output
+// optional lifecycle tracing into per-thread ring buffers with Chrome trace export (CPPWINRT_EX_ENABLE_TRACING)
+// optional runtime metrics: sharded counters, log-linear latency histograms, Prometheus writer (CPPWINRT_EX_ENABLE_METRICS)
+// optional stall_watchdog reports long-running continuations on completion threads and long-awaited futures (CPPWINRT_EX_ENABLE_WATCHDOG)
+// task_group spawns and joins a dynamic set of children with bounded concurrency and first-error cancellation
 
 #pragma once
 
 #include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
 #include <type_traits>
 #include <tuple>
 #include <utility>
 #include <exception>
 #include <memory>
 #include <array>
+#include <chrono>
+#include <iterator>
+#include <optional>
+#include <vector>
 #include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <new>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#define CPPWINRT_EX_STD_COROUTINES 1
+#else
 #include <experimental/resumable>
+#endif
 
+#if defined(_WIN32)
 #include <winrt/base.h>
+#else
+#include <cstring>
+#include <shared_mutex>
+#include <thread>
+#endif
+
+#if defined(CPPWINRT_EX_ENABLE_TRACING)
+#include <algorithm>
+#include <ostream>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(CPPWINRT_EX_ENABLE_METRICS)
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <ostream>
+#endif
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
 
 namespace winrt_ex
 {
 	namespace details
 	{
+#if defined(CPPWINRT_EX_STD_COROUTINES)
+		namespace coro = std;
+#else
+		namespace coro = std::experimental;
+#endif
+
+#if defined(_WIN32)
+		using TimeSpan = winrt::Windows::Foundation::TimeSpan;
+#else
+		// same representation as Windows::Foundation::TimeSpan
+		using TimeSpan = std::chrono::duration<int64_t, std::ratio<1, 10'000'000>>;
+#endif
+
+		[[noreturn]] inline void throw_canceled()
+		{
+#if defined(_WIN32)
+			throw winrt::hresult_canceled{};
+#else
+			throw std::system_error(std::make_error_code(std::errc::operation_canceled));
+#endif
+		}
+
+		// error reported by non-throwing awaitables when an operation has been cancelled
+		inline std::error_code canceled_error() noexcept
+		{
+			return std::make_error_code(std::errc::operation_canceled);
+		}
+
+		// Result of an operation that reports failure as an error code instead of an exception
+		// value() throws std::system_error if there is no value.
+		template<class T>
+		class expected
+		{
+			std::optional<T> val;
+			std::error_code err;
+
+		public:
+			template<class U = T, std::enable_if_t<std::is_constructible_v<T, U &&> && !std::is_same_v<std::decay_t<U>, expected>, int> = 0>
+			expected(U &&value) :
+				val{ std::in_place, std::forward<U>(value) }
+			{}
+
+			expected(std::error_code error) noexcept :
+				err{ error }
+			{}
+
+			bool has_value() const noexcept
+			{
+				return val.has_value();
+			}
+
+			explicit operator bool() const noexcept
+			{
+				return has_value();
+			}
+
+			const std::error_code &error() const noexcept
+			{
+				return err;
+			}
+
+			T &value() &
+			{
+				if (!val)
+					throw std::system_error(err);
+				return *val;
+			}
+
+			const T &value() const &
+			{
+				if (!val)
+					throw std::system_error(err);
+				return *val;
+			}
+
+			T &&value() &&
+			{
+				if (!val)
+					throw std::system_error(err);
+				return std::move(*val);
+			}
+
+			T &operator *() & noexcept
+			{
+				return *val;
+			}
+
+			const T &operator *() const & noexcept
+			{
+				return *val;
+			}
+
+			T &&operator *() && noexcept
+			{
+				return std::move(*val);
+			}
+
+			T *operator ->() noexcept
+			{
+				return &*val;
+			}
+
+			const T *operator ->() const noexcept
+			{
+				return &*val;
+			}
+		};
+
+		template<>
+		class expected<void>
+		{
+			std::error_code err;
+
+		public:
+			expected() noexcept = default;
+
+			expected(std::error_code error) noexcept :
+				err{ error }
+			{}
+
+			bool has_value() const noexcept
+			{
+				return !err;
+			}
+
+			explicit operator bool() const noexcept
+			{
+				return has_value();
+			}
+
+			const std::error_code &error() const noexcept
+			{
+				return err;
+			}
+
+			void value() const
+			{
+				if (err)
+					throw std::system_error(err);
+			}
+		};
+
 		// future
+#if defined(_WIN32)
 		// Windows SRW lock wrapped in shared_mutex-friendly class
 		class srwlock
 		{
@@ -61,763 +281,6665 @@ namespace winrt_ex
 				ReleaseSRWLockShared(&m_lock);
 			}
 		};
-
-
-		enum class status_t
-		{
-			running,
-			ready,
-			exception
-		};
-
-		struct promise_base0
+#else
+		// Portable replacement for SRW lock with the same interface
+		class srwlock
 		{
-			srwlock lock;
-			std::experimental::coroutine_handle<> resume{};
-			std::exception_ptr exception;
-			std::atomic<int> use_count{ 1 };
+			std::shared_mutex m_lock;
+		public:
+			srwlock(const srwlock &) = delete;
+			srwlock & operator=(const srwlock &) = delete;
+			srwlock() noexcept = default;
 
-			status_t status{ status_t::running };
+			void lock() noexcept
+			{
+				m_lock.lock();
+			}
 
-			bool is_ready() const noexcept
+			void lock_shared() noexcept
 			{
-				return status != status_t::running;
+				m_lock.lock_shared();
 			}
 
-			void check_resume(std::unique_lock<srwlock> &&l)
+			bool try_lock() noexcept
 			{
-				if (resume)
-				{
-					l.unlock();
-					resume();
-				}
+				return m_lock.try_lock();
 			}
 
-			void set_exception(std::exception_ptr exception_)
+			void unlock() noexcept
 			{
-				std::unique_lock<srwlock> l(lock);
-				exception = exception_;
-				status = status_t::exception;
-				check_resume(std::move(l));
+				m_lock.unlock();
 			}
 
-			void check_exception()
+			void unlock_shared() noexcept
 			{
-				assert(is_ready());
-//				std::unique_lock<srwlock> l(lock);
-				if (status == status_t::exception && exception)
-					std::rethrow_exception(exception);
+				m_lock.unlock_shared();
 			}
 		};
+#endif
 
-		template<class T>
-		struct promise_base : promise_base0
+		// Blocking wait on a 32-bit atomic word
+		// Uses futex on Linux and WaitOnAddress on Windows 8 and later. Elsewhere, untimed waits use std::atomic::wait if
+		// available and other waits poll with a short sleep.
+#if defined(_WIN32) && _WIN32_WINNT >= 0x0602
+#pragma comment(lib, "Synchronization.lib")
+#endif
+
+		inline void cpu_relax() noexcept
 		{
-			T value;
+#if defined(_WIN32)
+			YieldProcessor();
+#elif defined(__x86_64__) || defined(__i386__)
+			__builtin_ia32_pause();
+#elif defined(__aarch64__)
+			asm volatile("yield");
+#endif
+		}
 
-			template<class V>
-			void return_value(V &&v)
+		// blocks while word holds value; returns on change, on timeout (if given) or spuriously
+		inline void wait_on_address(std::atomic<unsigned> &word, unsigned value, const std::chrono::nanoseconds *timeout = nullptr) noexcept
+		{
+			static_assert(sizeof(std::atomic<unsigned>) == sizeof(uint32_t), "atomic word must be 32 bits wide");
+#if defined(__linux__)
+			timespec ts{};
+			if (timeout)
 			{
-				std::unique_lock<srwlock> l(lock);
-				value = std::forward<V>(v);
-				status = status_t::ready;
-				check_resume(std::move(l));
+				ts.tv_sec = static_cast<time_t>(timeout->count() / 1'000'000'000);
+				ts.tv_nsec = static_cast<long>(timeout->count() % 1'000'000'000);
 			}
-
-			T &get()
+			syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAIT_PRIVATE, value, timeout ? &ts : nullptr, nullptr, 0);
+#elif defined(_WIN32) && _WIN32_WINNT >= 0x0602
+			DWORD milliseconds = INFINITE;
+			if (timeout)
+				milliseconds = static_cast<DWORD>((std::min)(std::chrono::ceil<std::chrono::milliseconds>(*timeout).count(), static_cast<long long>(INFINITE - 1)));
+			WaitOnAddress(&word, &value, sizeof(value), milliseconds);
+#else
+#if defined(__cpp_lib_atomic_wait)
+			if (!timeout)
+				word.wait(value, std::memory_order_acquire);
+			else
+#endif
+			if (word.load(std::memory_order_acquire) == value)
 			{
-				check_exception();
-				return value;
+				// no suitable wait primitive: sleep for a fraction of the remaining time, at most a millisecond
+				const std::chrono::nanoseconds limit{ std::chrono::milliseconds{ 1 } };
+				std::this_thread::sleep_for(timeout ? (std::min)(*timeout / 8 + std::chrono::microseconds{ 10 }, limit) : limit);
 			}
-		};
+#endif
+		}
 
-		template<>
-		struct promise_base<void> : promise_base0
+		inline void wake_by_address_all(std::atomic<unsigned> &word) noexcept
 		{
-			void return_void()
+#if defined(__linux__)
+			syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+#elif defined(_WIN32) && _WIN32_WINNT >= 0x0602
+			WakeByAddressAll(&word);
+#else
+			word.notify_all();
+#endif
+		}
+
+		// Spin lock for short critical sections that must not enter the kernel
+		class spinlock
+		{
+			std::atomic<bool> locked{ false };
+
+		public:
+			spinlock(const spinlock &) = delete;
+			spinlock &operator =(const spinlock &) = delete;
+			spinlock() noexcept = default;
+
+			void lock() noexcept
 			{
-				std::unique_lock<srwlock> l(lock);
-				status = status_t::ready;
-				check_resume(std::move(l));
+				while (locked.exchange(true, std::memory_order_acquire))
+				{
+					while (locked.load(std::memory_order_relaxed))
+						cpu_relax();
+				}
 			}
 
-			struct empty_type {};
+			bool try_lock() noexcept
+			{
+				return !locked.load(std::memory_order_relaxed) && !locked.exchange(true, std::memory_order_acquire);
+			}
 
-			empty_type get()
+			void unlock() noexcept
 			{
-				check_exception();
-				return {};
+				locked.store(false, std::memory_order_release);
 			}
 		};
 
-		template<class T>
-		class future_base
+		// Intrusive FIFO list of suspended awaiters; Node provides prev and next pointers
+		template<class Node>
+		class waiter_list
 		{
-		protected:
-			const T &iget(T &value) const &
+			Node *head{};
+			Node *tail{};
+
+		public:
+			bool empty() const noexcept
 			{
-				return value;
+				return !head;
 			}
 
-			T &&iget(T &value) &&
+			Node *front() const noexcept
 			{
-				return std::move(value);
+				return head;
 			}
-		};
 
-		template<>
-		class future_base<void>
-		{
-		protected:
-			template<class T>
-			void iget(T &)
+			void push_back(Node *node) noexcept
+			{
+				node->next = nullptr;
+				node->prev = tail;
+				if (tail)
+					tail->next = node;
+				else
+					head = node;
+				tail = node;
+			}
+
+			void remove(Node *node) noexcept
+			{
+				if (node->prev)
+					node->prev->next = node->next;
+				else
+					head = static_cast<Node *>(node->next);
+				if (node->next)
+					node->next->prev = node->prev;
+				else
+					tail = static_cast<Node *>(node->prev);
+				node->prev = node->next = nullptr;
+			}
+
+			Node *pop_front() noexcept
 			{
+				auto node = head;
+				if (node)
+					remove(node);
+				return node;
+			}
+
+			// detaches all nodes, which stay linked through next
+			Node *take_all() noexcept
+			{
+				auto node = head;
+				head = tail = nullptr;
+				return node;
 			}
 		};
 
-		template<class T>
-		class future : public future_base<T>
+		// Recycling allocator for coroutine frames
+		// Frames are served from per-thread free lists split into size classes. A frame released on a thread other than the
+		// one that allocated it is pushed onto the lock-free return stack of the owning cache and reclaimed by the owner on its
+		// next allocation. The return stack is bounded, frames beyond the bound are freed. Caches of exited threads reclaim
+		// their return stacks and are kept in an orphan list to be adopted by new threads. Frames released while a thread's
+		// thread_local objects are being destroyed bypass the cache of that thread.
+		// Define CPPWINRT_EX_DISABLE_FRAME_RECYCLING to forward all frame allocations to global operator new.
+		class frame_allocator
 		{
-			static_assert(!std::is_reference_v<T>, "future<T> is not allowed for reference types");
-			struct promise_type_ : promise_base<T>
+			static constexpr size_t granularity = 64;
+			static constexpr size_t size_classes = 16;
+			static constexpr size_t max_cached = 256;
+			static constexpr size_t max_returned = 1024;
+#if defined(CPPWINRT_EX_DISABLE_FRAME_RECYCLING)
+			static constexpr bool recycling_enabled = false;
+#else
+			static constexpr bool recycling_enabled = true;
+#endif
+
+			struct cache;
+
+			struct alignas(std::max_align_t) header
 			{
-				srwlock lock;
-				std::experimental::coroutine_handle<> destroy_resume{};
-				bool future_exists{ true };
+				cache *owner;
+				void (*deallocate)(header *, size_t) noexcept;
+			};
 
-				//
-				bool start_async(std::experimental::coroutine_handle<> resume_)
-				{
-					const std::lock_guard<srwlock> l(lock);
-					if (is_ready())
-						return false;	// we already have a result
-					resume = resume_;
-					return true;
-				}
+			// free block, overlaps header
+			struct node
+			{
+				node *next;
+				size_t index;
+			};
 
-				static std::experimental::suspend_never initial_suspend() noexcept
-				{
-					return {};
-				}
+			struct cache
+			{
+				node *free[size_classes]{};
+				size_t count[size_classes]{};
+				std::atomic<node *> returned{ nullptr };
+				std::atomic<size_t> returned_count{ 0 };
+				cache *next_orphan{ nullptr };
 
-				auto final_suspend() noexcept
+				void *pop(size_t index) noexcept
 				{
-					struct awaiter
+					if (!free[index])
+						reclaim();
+					auto n = free[index];
+					if (n)
 					{
-						promise_type_ *pthis;
-
-						bool await_ready() const noexcept
-						{
-							pthis->lock.lock();
-							auto is_ready = !pthis->future_exists;
-							if (is_ready)
-								pthis->lock.unlock();
-							return is_ready;
-						}
-
-						void await_suspend(std::experimental::coroutine_handle<> resume) noexcept
-						{
-							pthis->destroy_resume = resume;
-							pthis->lock.unlock();
-						}
-
-						static void await_resume() noexcept
-						{
-						}
-					};
-					return awaiter{ this };
+						free[index] = n->next;
+						--count[index];
+					}
+					return n;
 				}
 
-				future<T> get_return_object() noexcept
+				void push(node *n) noexcept
 				{
-					return { this };
+					if (count[n->index] < max_cached)
+					{
+						n->next = free[n->index];
+						free[n->index] = n;
+						++count[n->index];
+					}
+					else
+						::operator delete(n);
 				}
 
-				void add_ref()
+				void push_returned(node *n) noexcept
 				{
-					use_count.fetch_add(1, std::memory_order_relaxed);
-				}
+					// the owner may not allocate again for a long time
+					if (returned_count.fetch_add(1, std::memory_order_relaxed) >= max_returned)
+					{
+						returned_count.fetch_sub(1, std::memory_order_relaxed);
+						return ::operator delete(n);
+					}
 
-				void release()
-				{
-					if (1 == use_count.fetch_sub(1, std::memory_order_relaxed))
-						destroy();
+					auto head = returned.load(std::memory_order_relaxed);
+					do
+					{
+						n->next = head;
+					} while (!returned.compare_exchange_weak(head, n, std::memory_order_release, std::memory_order_relaxed));
 				}
 
-				void destroy()
+				void reclaim() noexcept
 				{
-					std::unique_lock<srwlock> l(lock);
-					future_exists = false;
-					if (destroy_resume)
+					auto n = returned.exchange(nullptr, std::memory_order_acquire);
+					size_t reclaimed = 0;
+					while (n)
 					{
-						l.unlock();
-						destroy_resume.destroy();
+						auto next = n->next;
+						push(n);
+						n = next;
+						++reclaimed;
 					}
+					returned_count.fetch_sub(reclaimed, std::memory_order_relaxed);
 				}
 			};
 
-			promise_type_ *promise;
+			// the registry is intentionally leaked: frames may be released after static destruction has begun
+			struct orphans
+			{
+				std::mutex lock;
+				cache *head{ nullptr };
 
-			future(promise_type_ *promise) noexcept :
-				promise{ promise }
-			{}
+				static orphans &get() noexcept
+				{
+					static orphans *const instance = new orphans;
+					return *instance;
+				}
+			};
 
-			struct special_await
+			// trivially destructible, so it remains usable while other thread_local objects are destroyed
+			struct thread_state
 			{
-				promise_type_ *promise;
+				cache *ptr;
+				bool exited;
+			};
+
+			static thread_state &state() noexcept
+			{
+				thread_local thread_state instance{ nullptr, false };
+				return instance;
+			}
 
-				bool await_ready() const
+			struct local_cache
+			{
+				local_cache()
 				{
-					return promise->is_ready();
+					state().ptr = adopt();
 				}
 
-				bool await_suspend(std::experimental::coroutine_handle<> resume)
+				~local_cache()
 				{
-					return promise->start_async(resume);
+					auto &s = state();
+					auto ptr = std::exchange(s.ptr, nullptr);
+					s.exited = true;
+					ptr->reclaim();
+
+					auto &o = orphans::get();
+					const std::lock_guard<std::mutex> l(o.lock);
+					ptr->next_orphan = o.head;
+					o.head = ptr;
 				}
 
-				void await_resume()
+				static cache *adopt()
 				{
+					{
+						auto &o = orphans::get();
+						const std::lock_guard<std::mutex> l(o.lock);
+						if (auto c = o.head)
+						{
+							o.head = c->next_orphan;
+							return c;
+						}
+					}
+					return new cache;
 				}
 			};
 
-		public:
-			using promise_type = promise_type_;
-
-			~future()
+			// null once the thread has started destroying its thread_local objects
+			static cache *current()
 			{
-				if (promise)
-					promise->release();
+				auto &s = state();
+				if (!s.ptr && !s.exited)
+				{
+					thread_local local_cache local;
+				}
+				return s.ptr;
 			}
 
-			future(const future &o) noexcept :
-			promise{ o.promise }
+			static size_t get_index(size_t size) noexcept
 			{
-				if (promise)
-					promise->add_ref();
+				return recycling_enabled ? (size + sizeof(header) - 1) / granularity : size_classes;
 			}
 
-			future &operator =(const future &o) noexcept
+			// allocator-aware frames: [header][frame][allocator]
+			static size_t get_allocator_offset(size_t size) noexcept
 			{
-				if (promise)
-					promise->release();
-				promise = o.promise;
-				if (promise)
-					promise->add_ref();
+				return sizeof(header) + (size + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) * alignof(std::max_align_t);
 			}
 
-			future(future &&o) noexcept :
-				promise{ o.promise }
+			template<class ByteAllocator>
+			static size_t get_units(size_t size) noexcept
 			{
-				o.promise = nullptr;
+				return (get_allocator_offset(size) + sizeof(ByteAllocator) + sizeof(std::max_align_t) - 1) / sizeof(std::max_align_t);
 			}
 
-			future &operator =(future &&o) noexcept
+			template<class ByteAllocator>
+			static void deallocate_with(header *h, size_t size) noexcept
 			{
-				using std::swap;
-				swap(promise, o.promise);
-				return *this;
+				auto stored = reinterpret_cast<ByteAllocator *>(reinterpret_cast<char *>(h) + get_allocator_offset(size));
+				ByteAllocator allocator{ std::move(*stored) };
+				stored->~ByteAllocator();
+				std::allocator_traits<ByteAllocator>::deallocate(allocator, reinterpret_cast<std::max_align_t *>(h), get_units<ByteAllocator>(size));
 			}
 
-			void wait()
+		public:
+			static void *allocate(size_t size)
 			{
-				if (promise->status != status_t::running)
-					return;
-
-				winrt::impl::lock x;
-				winrt::impl::condition_variable cv;
-				bool completed = false;
-
-				[&]()->winrt::fire_and_forget
+				const auto index = get_index(size);
+				header *h;
+				if (index < size_classes)
 				{
-					co_await special_await{ promise };
-					const winrt::impl::lock_guard guard(x);
-					completed = true;
-					cv.wake_one();
-				}();
-
-				const winrt::impl::lock_guard guard(x);
-				cv.wait_while(x, [&] { return !completed; });
+					auto c = current();
+					h = c ? static_cast<header *>(c->pop(index)) : nullptr;
+					if (!h)
+						h = static_cast<header *>(::operator new((index + 1) * granularity));
+					h->owner = c;
+				}
+				else
+				{
+					h = static_cast<header *>(::operator new(size + sizeof(header)));
+					h->owner = nullptr;
+				}
+				h->deallocate = nullptr;
+				return h + 1;
 			}
 
-			decltype(auto) get()
+			template<class Allocator>
+			static void *allocate(size_t size, const Allocator &allocator)
 			{
-				wait();
-				return iget(promise->get());
+				using byte_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<std::max_align_t>;
+				static_assert(alignof(byte_allocator) <= alignof(std::max_align_t), "allocator type is over-aligned");
+
+				byte_allocator a{ allocator };
+				auto h = reinterpret_cast<header *>(std::allocator_traits<byte_allocator>::allocate(a, get_units<byte_allocator>(size)));
+				new (reinterpret_cast<char *>(h) + get_allocator_offset(size)) byte_allocator{ std::move(a) };
+				h->owner = nullptr;
+				h->deallocate = &deallocate_with<byte_allocator>;
+				return h + 1;
 			}
 
-			// await
-			bool await_ready() const
+			static void deallocate(void *ptr, size_t size) noexcept
 			{
-				return promise->is_ready();
+				auto h = static_cast<header *>(ptr) - 1;
+				if (h->deallocate)
+					return h->deallocate(h, size);
+
+				const auto index = get_index(size);
+				auto owner = h->owner;
+				if (index >= size_classes || !owner)
+					return ::operator delete(h);
+
+				// a thread that has not allocated yet does not need a cache to return frames
+				auto &s = state();
+				if (s.exited)
+					return ::operator delete(h);
+
+				auto n = new (h) node{ nullptr, index };
+				if (owner == s.ptr)
+					owner->push(n);
+				else
+					owner->push_returned(n);
 			}
+		};
 
-			bool await_suspend(std::experimental::coroutine_handle<> resume)
+		// Promise base that places coroutine frames with frame_allocator
+		struct frame_allocated
+		{
+			static void *operator new(size_t size)
 			{
-				return promise->start_async(resume);
+				return frame_allocator::allocate(size);
 			}
 
-			void iawait_resume(std::true_type)
+			// coroutines that take std::allocator_arg_t followed by an allocator as their first parameters allocate the frame with that allocator
+			template<class Allocator, class...Args>
+			static void *operator new(size_t size, std::allocator_arg_t, const Allocator &allocator, const Args &...)
 			{
-				promise->get();
+				return frame_allocator::allocate(size, allocator);
 			}
 
-			decltype(auto) iawait_resume(std::false_type)
+			// same for member function coroutines
+			template<class This, class Allocator, class...Args>
+			static void *operator new(size_t size, const This &, std::allocator_arg_t, const Allocator &allocator, const Args &...)
 			{
-				return std::move(promise->get());
+				return frame_allocator::allocate(size, allocator);
 			}
 
-			decltype(auto) await_resume()
+			static void operator delete(void *ptr, size_t size) noexcept
 			{
-				return iawait_resume(std::is_same<T, void>{});
+				frame_allocator::deallocate(ptr, size);
 			}
 		};
-		
-		// no_result will substitute 'void' in tuple
-		struct no_result {};
-
-		// get_result_type 
-		// get the coroutine result type
-		// supports IAsyncAction, IAsyncOperation<T> and awaitable object that implements await_resume
-		// yields result_type<T> where T is a coroutine result type
-		template<class T>
-		struct result_type
-		{
-			using type = T;
-		};
 
-		constexpr result_type<void> get_result_type(const ::winrt::Windows::Foundation::IAsyncAction &)
+		// target of symmetric transfer when there is no coroutine to resume
+		inline coro::coroutine_handle<> or_noop(coro::coroutine_handle<> handle) noexcept
 		{
-			return {};
+			return handle ? handle : coro::noop_coroutine();
 		}
 
-		template<class T>
-		constexpr result_type<T> get_result_type(const ::winrt::Windows::Foundation::IAsyncOperation<T> &)
+		// Minimal detached coroutine type used by internal helpers instead of winrt::fire_and_forget
+		// The coroutine returns the coroutine to continue with (or null), which is resumed by symmetric transfer after the
+		// frame has been freed.
+		struct detached_handoff
 		{
-			return {};
-		}
-
-		// primary template handles types that do not implement await_resume:
-		template<class, class = std::void_t<>>
-		struct has_await_resume : std::false_type {};
+			struct promise_type
+			{
+				coro::coroutine_handle<> next;
 
-		// specialization recognizes types that do implement await_resume
-		template<class T>
-		struct has_await_resume<T, std::void_t<decltype(std::declval<T&>().await_resume())>> : std::true_type {};
+				static void *operator new(size_t size)
+				{
+					return frame_allocator::allocate(size);
+				}
 
-		template<class T>
-		constexpr bool has_await_resume_v = has_await_resume<T>::value;
+				static void operator delete(void *ptr, size_t size) noexcept
+				{
+					frame_allocator::deallocate(ptr, size);
+				}
 
-		// "external" cae
-		template<class, class = std::void_t<>>
-		struct has_external_await_resume : std::false_type {};
+				detached_handoff get_return_object() const noexcept
+				{
+					return {};
+				}
 
-		template<class T>
-		struct has_external_await_resume<T, std::void_t<decltype(await_resume(std::declval<T &>()))>> : std::true_type {};
+				static coro::suspend_never initial_suspend() noexcept
+				{
+					return {};
+				}
 
-		template<class T>
-		constexpr bool has_external_await_resume_v = has_external_await_resume<T>::value;
+				auto final_suspend() noexcept
+				{
+					struct awaiter
+					{
+						static bool await_ready() noexcept
+						{
+							return false;
+						}
 
-		//
-		template<class T>
-		constexpr result_type<decltype(std::declval<T &>().await_resume())> get_result_type(const T &, std::enable_if_t<has_await_resume_v<T>, void *> = nullptr)
-		{
-			return {};
-		}
+						static coro::coroutine_handle<> await_suspend(coro::coroutine_handle<promise_type> handle) noexcept
+						{
+							const auto next = handle.promise().next;
+							handle.destroy();
+							return or_noop(next);
+						}
 
-		template<class T>
-		constexpr result_type<decltype(await_resume(std::declval<T &>()))> get_result_type(const T &, std::enable_if_t<has_external_await_resume_v<T>, void *> = nullptr)
-		{
-			return {};
-		}
+						static void await_resume() noexcept
+						{
+						}
+					};
+					return awaiter{};
+				}
 
-		// Helper to get a coroutine result type for a first item in variadic sequence
-		template<class First, class...Rest>
-		constexpr auto get_first_result_type(const First &first, const Rest &...)
-		{
-			return get_result_type(first);
-		}
+				void return_value(coro::coroutine_handle<> next_) noexcept
+				{
+					next = next_;
+				}
 
-		// Get a first type in a variadic type list
-		template<class...T>
-		struct get_first;
+				static void unhandled_exception() noexcept
+				{
+					std::terminate();
+				}
+			};
+		};
 
-		template<class F,class...R>
-		struct get_first<F, R...>
+		// Lifecycle tracing
+		// Define CPPWINRT_EX_ENABLE_TRACING to record lifecycle events of futures, combinators, timers and I/O operations.
+		// Every thread writes fixed-size records into its own ring buffer of CPPWINRT_EX_TRACE_BUFFER_SIZE records, the
+		// oldest records are overwritten. Records are published with a per-record sequence number, so write_chrome_trace
+		// may run concurrently with writers and skips records that are being overwritten. Buffers of exited threads are
+		// adopted by new threads. Without the macro, trace() is an empty inline function.
+		enum class trace_event : uint16_t
 		{
-			using type = F;
+			future_created,
+			future_suspended,	// a coroutine has started waiting for the future
+			future_completed,
+			future_resumed,		// the waiting coroutine is resumed by the completing thread
+			future_destroyed,
+			when_all_started,
+			when_all_completed,
+			when_any_started,
+			when_any_completed,
+			timer_armed,
+			timer_fired,
+			timer_cancelled,
+			io_submitted,
+			io_completed,
 		};
 
-		template<class...T>
-		using get_first_t = typename get_first<T...>::type;
+#if defined(CPPWINRT_EX_ENABLE_TRACING)
+#if !defined(CPPWINRT_EX_TRACE_BUFFER_SIZE)
+#define CPPWINRT_EX_TRACE_BUFFER_SIZE 16384
+#endif
+		constexpr bool tracing_enabled = true;
 
-		// when_all
-		template<size_t Index, class Master, class Awaitable>
-		inline auto when_all_helper_single(Master &master, Awaitable task) noexcept ->
-			std::enable_if_t<
-				std::is_same_v<
-					result_type<void>,
-					decltype(get_result_type(task))
-				>,
-				winrt::fire_and_forget
-			>
+		class trace_log
 		{
-			try
-			{
-				co_await task;
-				master.finished<Index>();
-			}
-			catch (...)
-			{
-				master.finished_exception();
-			}
-		}
+			static constexpr uint64_t capacity = CPPWINRT_EX_TRACE_BUFFER_SIZE;
+			static_assert((capacity & (capacity - 1)) == 0, "CPPWINRT_EX_TRACE_BUFFER_SIZE must be a power of two");
 
-		template<size_t Index, class Master, class Awaitable>
-		inline auto when_all_helper_single(Master &master, Awaitable task) noexcept ->
-			std::enable_if_t<
-				!std::is_same_v<
-					result_type<void>,
-					decltype(get_result_type(task))
-				>,
-				winrt::fire_and_forget
-			>
-		{
-			try
-			{
-				master.finished<Index>(co_await task);
-			}
-			catch (...)
+			// 0 in sequence marks a record that is being written, otherwise it is the record's position + 1
+			struct record
 			{
-				master.finished_exception();
+				std::atomic<uint64_t> sequence{ 0 };
+				std::atomic<uint64_t> timestamp{ 0 };
+				std::atomic<const void *> object{ nullptr };
+				std::atomic<uint32_t> thread{ 0 };
+				std::atomic<uint32_t> argument{ 0 };
+				std::atomic<trace_event> event{};
 			};
-		}
 
-		template<class Master, class Tuple, size_t...I>
-		inline void when_all_helper(Master &master, Tuple &&tuple, std::index_sequence<I...>) noexcept
-		{
-			[[maybe_unused]] auto x = { when_all_helper_single<I>(master, std::get<I>(std::move(tuple)))... };
-		}
+			struct buffer
+			{
+				buffer *next{ nullptr };
+				std::atomic<bool> in_use{ true };
+				std::atomic<uint64_t> position{ 0 };	// written by the owning thread only
+				record records[capacity];
+			};
 
-		template<class...Awaitables>
-		struct when_all_awaitable_base
-		{
-			std::exception_ptr exception;
-			std::atomic<int> counter;
-			std::experimental::coroutine_handle<> resume;
-			std::tuple<std::decay_t<Awaitables>...> awaitables;
+			// buffer of the current thread, released to other threads on thread exit
+			struct owner
+			{
+				buffer *current{ nullptr };
+				uint32_t thread{ 0 };
 
-			when_all_awaitable_base(Awaitables &&...awaitables) noexcept :
-				awaitables{ std::forward<Awaitables>(awaitables)... },
-				counter{ sizeof...(awaitables) }
-			{}
+				~owner()
+				{
+					if (current)
+						current->in_use.store(false, std::memory_order_release);
+				}
+			};
 
-			when_all_awaitable_base(when_all_awaitable_base &&o) noexcept :
-				exception{ std::move(o.exception) },
-				counter{ o.counter.load(std::memory_order_relaxed) },	// it is safe to "move" atomic this way because we don't "use" it until the final instance is allocated
-				resume{ o.resume },
-				awaitables{ std::move(o.awaitables) }
-			{}
+			struct clock_origin
+			{
+				uint64_t ticks;
+				std::chrono::steady_clock::time_point time;
+			};
 
-			void finished_exception() noexcept
+			static std::atomic<buffer *> &buffers() noexcept
 			{
-				if (!exception)
-					exception = std::current_exception();
-				check_resume();
+				static std::atomic<buffer *> head{ nullptr };
+				return head;
 			}
 
-			void check_resume() noexcept
+			static uint64_t ticks() noexcept
 			{
-				if (0 == counter.fetch_sub(1, std::memory_order_relaxed) - 1)
-					resume();
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+				return __rdtsc();
+#elif defined(__x86_64__) || defined(__i386__)
+				return __builtin_ia32_rdtsc();
+#else
+				return static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
 			}
 
-			bool await_ready() const noexcept
+			static const clock_origin &origin() noexcept
 			{
-				return false;
+				static const clock_origin value{ ticks(), std::chrono::steady_clock::now() };
+				return value;
 			}
-		};
 
-		// void case
-		template<class...Awaitables>
-		struct when_all_awaitable_void : when_all_awaitable_base<Awaitables...>
-		{
-			when_all_awaitable_void(Awaitables &&...awaitables) noexcept :
-				when_all_awaitable_base{ std::forward<Awaitables>(awaitables)... }
-			{}
+			// reuses a buffer of an exited thread or allocates a new one
+			static buffer *acquire() noexcept
+			{
+				origin();
+				auto &head = buffers();
+				for (auto current = head.load(std::memory_order_acquire); current; current = current->next)
+				{
+					bool expected = false;
+					if (!current->in_use.load(std::memory_order_relaxed) && current->in_use.compare_exchange_strong(expected, true, std::memory_order_acquire))
+						return current;
+				}
 
-			when_all_awaitable_void(when_all_awaitable_void &&o) noexcept :
-				when_all_awaitable_base{ static_cast<when_all_awaitable_base &&>(o) }
-			{}
+				auto created = new (std::nothrow) buffer{};
+				if (created)
+				{
+					created->next = head.load(std::memory_order_relaxed);
+					while (!head.compare_exchange_weak(created->next, created, std::memory_order_release, std::memory_order_relaxed))
+						;
+				}
+				return created;
+			}
 
-			template<size_t, class T>
-			void finished(const T &) noexcept
+			static owner &local() noexcept
 			{
-				check_resume();
+				static std::atomic<uint32_t> next_thread{ 0 };
+				thread_local owner instance;
+				if (!instance.current)
+				{
+					instance.current = acquire();
+					instance.thread = next_thread.fetch_add(1, std::memory_order_relaxed) + 1;
+				}
+				return instance;
 			}
 
-			template<size_t>
-			void finished() noexcept
+			static const char *name(trace_event event) noexcept
 			{
-				check_resume();
+				switch (event)
+				{
+				case trace_event::future_created:
+				case trace_event::future_destroyed:
+					return "future";
+				case trace_event::future_suspended:
+				case trace_event::future_resumed:
+					return "suspended";
+				case trace_event::future_completed:
+					return "completed";
+				case trace_event::when_all_started:
+				case trace_event::when_all_completed:
+					return "when_all";
+				case trace_event::when_any_started:
+				case trace_event::when_any_completed:
+					return "when_any";
+				case trace_event::timer_armed:
+				case trace_event::timer_fired:
+				case trace_event::timer_cancelled:
+					return "timer";
+				default:
+					return "io";
+				}
 			}
 
-			void await_suspend(std::experimental::coroutine_handle<> handle) noexcept
+			// Chrome trace category, events of one object share it so that nested async events match
+			static const char *category(trace_event event) noexcept
 			{
-				resume = handle;
-				using index_t = std::make_index_sequence<sizeof...(Awaitables)>;
-				when_all_helper(*this, std::move(awaitables), index_t{});
+				if (event <= trace_event::future_destroyed)
+					return "future";
+				if (event <= trace_event::when_any_completed)
+					return "combinator";
+				if (event <= trace_event::timer_cancelled)
+					return "timer";
+				return "io";
 			}
 
-			void await_resume() const
+			static char phase(trace_event event) noexcept
 			{
-				if (exception)
-					std::rethrow_exception(exception);
+				switch (event)
+				{
+				case trace_event::future_created:
+				case trace_event::future_suspended:
+				case trace_event::when_all_started:
+				case trace_event::when_any_started:
+				case trace_event::timer_armed:
+				case trace_event::io_submitted:
+					return 'b';
+				case trace_event::future_completed:
+					return 'n';
+				default:
+					return 'e';
+				}
 			}
-		};
 
-		template<class...Awaitables>
-		inline auto when_all_impl(std::true_type, Awaitables &&...awaitables)
-		{
-			return when_all_awaitable_void<Awaitables...> { std::forward<Awaitables>(awaitables)... };
-		}
+			static void write_arguments(std::ostream &out, trace_event event, uint32_t argument)
+			{
+				switch (event)
+				{
+				case trace_event::when_all_started:
+				case trace_event::when_any_started:
+					out << ",\"args\":{\"children\":" << argument << '}';
+					break;
+				case trace_event::when_any_completed:
+					out << ",\"args\":{\"winner\":" << argument << '}';
+					break;
+				case trace_event::timer_armed:
+					out << ",\"args\":{\"us\":" << argument << '}';
+					break;
+				case trace_event::timer_fired:
+					out << ",\"args\":{\"result\":\"fired\"}";
+					break;
+				case trace_event::timer_cancelled:
+					out << ",\"args\":{\"result\":\"cancelled\"}";
+					break;
+				case trace_event::io_submitted:
+					out << ",\"args\":{\"opcode\":" << argument << '}';
+					break;
+				case trace_event::io_completed:
+					out << ",\"args\":{\"result\":" << static_cast<int32_t>(argument) << '}';
+					break;
+				default:
+					break;
+				}
+			}
 
-		// non-void case
-		template<class...Awaitables>
-		struct when_all_awaitable_value : when_all_awaitable_base<Awaitables...>
-		{
-			template<class T>
-			struct transform
+		public:
+			static void record_event(trace_event event, const void *object, uint32_t argument) noexcept
 			{
-				using type = std::conditional_t<std::is_same_v<result_type<void>, T>, no_result, std::decay_t<typename T::type>>;
-			};
+				auto &self = local();
+				const auto current = self.current;
+				if (!current)
+					return;
 
-			template<class T>
-			using transform_t = typename transform<T>::type;
+				const auto position = current->position.load(std::memory_order_relaxed);
+				auto &r = current->records[position & (capacity - 1)];
+				r.sequence.store(0, std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_release);
+				r.timestamp.store(ticks(), std::memory_order_relaxed);
+				r.object.store(object, std::memory_order_relaxed);
+				r.thread.store(self.thread, std::memory_order_relaxed);
+				r.argument.store(argument, std::memory_order_relaxed);
+				r.event.store(event, std::memory_order_relaxed);
+				r.sequence.store(position + 1, std::memory_order_release);
+				current->position.store(position + 1, std::memory_order_relaxed);
+			}
 
-			template<class...Ts>
-			struct get_results_type
+			// writes the records of all threads in Chrome trace_event JSON format (chrome://tracing, Perfetto)
+			static void write_chrome_trace(std::ostream &out)
 			{
-				using type = std::tuple<transform_t<Ts>...>;
-			};
+				struct entry
+				{
+					uint64_t timestamp;
+					const void *object;
+					uint32_t thread;
+					uint32_t argument;
+					trace_event event;
+				};
 
-			using results_t = typename get_results_type<decltype(get_result_type(std::declval<Awaitables>()))...>::type;
-			results_t results;
+				std::vector<entry> entries;
+				for (auto current = buffers().load(std::memory_order_acquire); current; current = current->next)
+				{
+					const auto end = current->position.load(std::memory_order_relaxed);
+					for (auto position = end > capacity ? end - capacity : 0; position < end; ++position)
+					{
+						auto &r = current->records[position & (capacity - 1)];
+						if (r.sequence.load(std::memory_order_acquire) != position + 1)
+							continue;
+						entry e{ r.timestamp.load(std::memory_order_relaxed), r.object.load(std::memory_order_relaxed),
+							r.thread.load(std::memory_order_relaxed), r.argument.load(std::memory_order_relaxed), r.event.load(std::memory_order_relaxed) };
+						std::atomic_thread_fence(std::memory_order_acquire);
+						if (r.sequence.load(std::memory_order_relaxed) == position + 1)
+							entries.push_back(e);
+					}
+				}
 
-			when_all_awaitable_value(Awaitables &&...awaitables) noexcept :
-				when_all_awaitable_base{ std::forward<Awaitables>(awaitables)... }
-			{}
+				std::sort(entries.begin(), entries.end(), [](const entry &a, const entry &b) { return a.timestamp < b.timestamp; });
 
-			when_all_awaitable_value(when_all_awaitable_value &&o) noexcept :
-				when_all_awaitables_base{ static_cast<when_all_awaitable_base &&>(o) }
-			{}
+				// convert ticks to microseconds since the first record
+				const auto &from = origin();
+				const auto elapsed_ticks = static_cast<double>(ticks() - from.ticks);
+				const auto elapsed_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - from.time).count();
+				const auto us_per_tick = elapsed_ticks > 0 && elapsed_us > 0 ? elapsed_us / elapsed_ticks : 0.0;
 
-			template<size_t index, class T>
-			void finished(T &&result) noexcept
-			{
-				std::get<index>(results) = std::forward<T>(result);
-				check_resume();
+				const auto flags = out.flags();
+				out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+				const char *separator = "\n";
+				for (const auto &e : entries)
+				{
+					out << separator << "{\"name\":\"" << name(e.event) << "\",\"cat\":\"" << category(e.event) << "\",\"ph\":\"" << phase(e.event)
+						<< "\",\"id\":\"0x" << std::hex << reinterpret_cast<uintptr_t>(e.object) << std::dec
+						<< "\",\"ts\":" << std::fixed << (static_cast<double>(static_cast<int64_t>(e.timestamp - from.ticks)) * us_per_tick)
+						<< ",\"pid\":1,\"tid\":" << e.thread;
+					write_arguments(out, e.event, e.argument);
+					out << '}';
+					separator = ",\n";
+				}
+				out << "\n]}\n";
+				out.flags(flags);
 			}
+		};
 
-			template<size_t>
-			void finished() noexcept
-			{
-				check_resume();
-			}
+		inline void trace(trace_event event, const void *object, uint32_t argument = 0) noexcept
+		{
+			trace_log::record_event(event, object, argument);
+		}
 
-			void await_suspend(std::experimental::coroutine_handle<> handle) noexcept
-			{
-				resume = handle;
-				using index_t = std::make_index_sequence<sizeof...(Awaitables)>;
-				when_all_helper(*this, awaitables, index_t{});
-			}
+		inline void write_chrome_trace(std::ostream &out)
+		{
+			trace_log::write_chrome_trace(out);
+		}
+#else
+		constexpr bool tracing_enabled = false;
 
-			results_t await_resume() const
-			{
-				if (exception)
-					std::rethrow_exception(exception);
-				else
-					return results;
-			}
-		};
+		inline void trace(trace_event, const void *, uint32_t = 0) noexcept
+		{
+		}
+#endif
 
-		template<class...Awaitables>
-		inline auto when_all_impl(std::false_type, Awaitables &&...awaitables)
+		// saturating conversion of a timer duration to a trace argument
+		inline uint32_t trace_duration(TimeSpan duration) noexcept
 		{
-			return when_all_awaitable_value<Awaitables...> { std::forward<Awaitables>(awaitables)... };
+			if constexpr (tracing_enabled)
+			{
+				const auto us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+				return us <= 0 ? 0 : us >= UINT32_MAX ? UINT32_MAX : static_cast<uint32_t>(us);
+			}
+			else
+				return 0;
 		}
 
-		template<class...Awaitables>
-		inline auto when_all(Awaitables &&...awaitables)
+		// Runtime metrics
+		// Define CPPWINRT_EX_ENABLE_METRICS to maintain gauges and counters of live futures, armed timers, I/O operations
+		// and thread pool queues, and latency histograms of I/O operations and timer expiration. Updates are relaxed atomic
+		// additions to one of a fixed number of cache-aligned shards picked per thread, so they never take a lock and rarely
+		// share a cache line. get_metrics_snapshot() sums the shards. Without the macro, updates are empty inline functions.
+		// The macro changes the layout of io_ring::completion and must be defined the same way in all translation units.
+		enum class metric : unsigned
 		{
-			static_assert(sizeof...(Awaitables) >= 2, "when_all must be passed at least two arguments");
-			using first_type = decltype(get_first_result_type(awaitables...));
+			futures_alive,		// gauge: promises of future<T> and shared_future<T>
+			timers_armed,		// gauge: timer_wheel timers waiting for expiration
+			timers_fired,		// counter
+			io_in_flight,		// gauge: submitted resumable_io_timeout and io_batch operations
+			io_completed,		// counter
+			io_timed_out,		// counter: operations completed with a timeout error
+			pool_queued,		// gauge: continuations posted to thread pools and not yet started
+			count
+		};
 
-			return when_all_impl(
-				std::conjunction<
-					std::is_same<result_type<void>, first_type>,
-					are_all_same_t<decltype(get_result_type(awaitables))...>
-				>{}, std::forward<Awaitables>(awaitables)...);
-		}
+		enum class latency_metric : unsigned
+		{
+			io,					// from submission to completion
+			timer_lateness,		// from the expiration tick to the callback
+			count
+		};
 
-		///////////////////////////////////
+#if defined(CPPWINRT_EX_ENABLE_METRICS)
+		constexpr bool metrics_enabled = true;
 
-		// when_any
-		struct when_any_block_base
+		// Log-linear histogram of nanosecond values: exact below 8, then 8 buckets per power of two (12.5% precision) up
+		// to 2^40 ns. Larger values are counted in the last bucket.
+		class histogram_snapshot
 		{
-			std::exception_ptr exception;
-			std::atomic<std::experimental::coroutine_handle<>> resume{};
+		public:
+			static constexpr unsigned sub_bits = 3;
+			static constexpr uint64_t sub_count = uint64_t{ 1 } << sub_bits;
+			static constexpr unsigned max_exponent = 40;
+			static constexpr size_t bucket_count = (max_exponent - sub_bits + 1) * sub_count;
 
-			void finished_exception() noexcept
+			static constexpr size_t bucket_of(uint64_t value) noexcept
 			{
-				if (resume.load(std::memory_order_relaxed))
-				{
-					auto value = resume.exchange(nullptr, std::memory_order_relaxed);
-					if (value)
-					{
-						exception = std::current_exception();
-						value();
-					}
-				}
+				if (value < sub_count)
+					return static_cast<size_t>(value);
+				const auto exponent = static_cast<unsigned>(std::bit_width(value)) - 1;
+				if (exponent >= max_exponent)
+					return bucket_count - 1;
+				return (exponent - sub_bits + 1) * sub_count + static_cast<size_t>((value >> (exponent - sub_bits)) & (sub_count - 1));
 			}
-		};
 
-		// void case
-		struct when_any_block_void : when_any_block_base
-		{
-			size_t index;
+			static constexpr uint64_t lower_bound(size_t bucket) noexcept
+			{
+				if (bucket < sub_count)
+					return bucket;
+				const auto exponent = static_cast<unsigned>(bucket / sub_count) + sub_bits - 1;
+				return (sub_count + bucket % sub_count) << (exponent - sub_bits);
+			}
 
-			void finished(size_t index_) noexcept
+			// exclusive
+			static constexpr uint64_t upper_bound(size_t bucket) noexcept
 			{
-				if (resume.load(std::memory_order_relaxed))
-				{
-					auto value = resume.exchange(nullptr, std::memory_order_relaxed);
-					if (value)
-					{
-						index = index_;
-						value();
-					}
-				}
+				return bucket + 1 < bucket_count ? lower_bound(bucket + 1) : ~uint64_t{};
 			}
-		};
 
-		template<class T>
-		struct when_any_block_value : when_any_block_base
-		{
-			T result;
-			size_t index;
+			std::array<uint64_t, bucket_count> buckets{};
+			uint64_t count{ 0 };
+			uint64_t sum{ 0 };		// nanoseconds
 
-			void finished(T &&result_, size_t index_) noexcept
+			// upper bound of the bucket that holds the given quantile (0..1), 0 if there are no values
+			std::chrono::nanoseconds percentile(double quantile) const noexcept
 			{
-				if (resume.load(std::memory_order_relaxed))
+				if (!count)
+					return {};
+				const auto rank = (std::max)(uint64_t{ 1 }, static_cast<uint64_t>(std::ceil(quantile * static_cast<double>(count))));
+				uint64_t seen = 0;
+				for (size_t bucket = 0; bucket < bucket_count; ++bucket)
 				{
-					auto value = resume.exchange(nullptr, std::memory_order_relaxed);
-					if (value)
-					{
-						result = std::move(result_);
-						index = index_;
-						value();
-					}
+					seen += buckets[bucket];
+					if (seen >= rank)
+						return std::chrono::nanoseconds{ static_cast<int64_t>((std::min)(upper_bound(bucket) - 1, uint64_t{ INT64_MAX })) };
 				}
+				return std::chrono::nanoseconds{ static_cast<int64_t>(lower_bound(bucket_count - 1)) };
 			}
 		};
 
-		template<size_t Index, class Awaitable>
-		inline winrt::fire_and_forget when_any_helper_single(std::shared_ptr<when_any_block_void> master, Awaitable task) noexcept
+		struct metrics_snapshot
 		{
-			try
+			std::array<int64_t, static_cast<size_t>(metric::count)> values{};
+			std::array<histogram_snapshot, static_cast<size_t>(latency_metric::count)> histograms{};
+
+			int64_t operator[](metric m) const noexcept
 			{
-				co_await task;
-				master->finished(Index);
+				return values[static_cast<size_t>(m)];
 			}
-			catch (...)
+
+			const histogram_snapshot &operator[](latency_metric m) const noexcept
 			{
-				master->finished_exception();
+				return histograms[static_cast<size_t>(m)];
 			}
-		}
+		};
 
-		template<size_t N, class Tuple, size_t...I>
-		inline void when_any_helper(std::array<std::shared_ptr<when_any_block_void>, N> &&master, Tuple &&tuple, std::index_sequence<I...>) noexcept
+		class runtime_metrics
 		{
-			[[maybe_unused]] auto x = { when_any_helper_single<I>(std::get<I>(std::move(master)), std::get<I>(std::move(tuple)))... };
-		}
+			static constexpr size_t shard_count = 32;
 
-		template<class...Awaitables>
-		inline auto when_any_impl(result_type<void>, Awaitables &&...awaitables)
-		{
-			struct when_any_awaitable
+			struct histogram
 			{
-				std::shared_ptr<when_any_block_void> ptr;
-				std::tuple<std::decay_t<Awaitables>...> awaitables;
+				std::atomic<uint64_t> buckets[histogram_snapshot::bucket_count];
+				std::atomic<uint64_t> sum;
+			};
 
-				when_any_awaitable(Awaitables &&...awaitables) noexcept :
-					awaitables{ std::forward<Awaitables>(awaitables)... },
-					ptr{ std::make_shared<when_any_block_void>() }
-				{
-				}
+			struct alignas(64) shard
+			{
+				std::atomic<int64_t> values[static_cast<size_t>(metric::count)];
+				histogram histograms[static_cast<size_t>(latency_metric::count)];
+			};
 
-				bool await_ready() const noexcept
-				{
-					return false;
-				}
+			static shard *shards() noexcept
+			{
+				static shard instance[shard_count];
+				return instance;
+			}
 
-				void await_suspend(std::experimental::coroutine_handle<> handle)
-				{
-					ptr->resume.store(handle, std::memory_order_relaxed);
-					std::array<std::shared_ptr<when_any_block_void>, sizeof...(Awaitables)> references;
-					std::fill(references.begin(), references.end(), ptr);
+			static shard &local() noexcept
+			{
+				static std::atomic<size_t> next{ 0 };
+				thread_local const size_t index = next.fetch_add(1, std::memory_order_relaxed) % shard_count;
+				return shards()[index];
+			}
 
-					auto awaitables_local_copy = std::move(awaitables);
+		public:
+			static void add(metric m, int64_t delta) noexcept
+			{
+				local().values[static_cast<size_t>(m)].fetch_add(delta, std::memory_order_relaxed);
+			}
+
+			static void record(latency_metric m, std::chrono::nanoseconds value) noexcept
+			{
+				const auto ns = static_cast<uint64_t>((std::max)(value.count(), decltype(value.count()){ 0 }));
+				auto &h = local().histograms[static_cast<size_t>(m)];
+				h.buckets[histogram_snapshot::bucket_of(ns)].fetch_add(1, std::memory_order_relaxed);
+				h.sum.fetch_add(ns, std::memory_order_relaxed);
+			}
+
+			static metrics_snapshot snapshot() noexcept
+			{
+				metrics_snapshot result;
+				for (size_t s = 0; s < shard_count; ++s)
+				{
+					const auto &current = shards()[s];
+					for (size_t m = 0; m < result.values.size(); ++m)
+						result.values[m] += current.values[m].load(std::memory_order_relaxed);
+					for (size_t m = 0; m < result.histograms.size(); ++m)
+					{
+						auto &target = result.histograms[m];
+						for (size_t bucket = 0; bucket < histogram_snapshot::bucket_count; ++bucket)
+						{
+							const auto value = current.histograms[m].buckets[bucket].load(std::memory_order_relaxed);
+							target.buckets[bucket] += value;
+							target.count += value;
+						}
+						target.sum += current.histograms[m].sum.load(std::memory_order_relaxed);
+					}
+				}
+				return result;
+			}
+
+			// writes nanoseconds as exact decimal seconds, independent of the stream's floating point format
+			static void write_seconds(std::ostream &out, uint64_t ns)
+			{
+				char fraction[10] = "000000000";
+				auto rest = ns % 1'000'000'000;
+				for (int i = 8; i >= 0; --i, rest /= 10)
+					fraction[i] = static_cast<char>('0' + rest % 10);
+				int length = 9;
+				while (length && fraction[length - 1] == '0')
+					--length;
+				fraction[length] = 0;
+				out << ns / 1'000'000'000;
+				if (length)
+					out << '.' << fraction;
+			}
+
+			// Prometheus text exposition format; histograms are reported in seconds with a bucket per power of two
+			static void write_prometheus(std::ostream &out, const metrics_snapshot &snapshot)
+			{
+				static constexpr struct
+				{
+					metric m;
+					const char *name;
+					const char *type;
+					const char *help;
+				} values[] =
+				{
+					{ metric::futures_alive, "cppwinrt_ex_futures_alive", "gauge", "Promises of future<T> and shared_future<T> alive." },
+					{ metric::timers_armed, "cppwinrt_ex_timers_armed", "gauge", "Timers armed in timer wheels." },
+					{ metric::timers_fired, "cppwinrt_ex_timers_fired_total", "counter", "Timers that have expired." },
+					{ metric::io_in_flight, "cppwinrt_ex_io_in_flight", "gauge", "I/O operations submitted and not completed." },
+					{ metric::io_completed, "cppwinrt_ex_io_completed_total", "counter", "Completed I/O operations." },
+					{ metric::io_timed_out, "cppwinrt_ex_io_timed_out_total", "counter", "I/O operations that have timed out." },
+					{ metric::pool_queued, "cppwinrt_ex_thread_pool_queued", "gauge", "Continuations queued in thread pools." },
+				};
+
+				static constexpr struct
+				{
+					latency_metric m;
+					const char *name;
+					const char *help;
+				} histograms[] =
+				{
+					{ latency_metric::io, "cppwinrt_ex_io_latency_seconds", "Time from submission to completion of I/O operations." },
+					{ latency_metric::timer_lateness, "cppwinrt_ex_timer_lateness_seconds", "Delay of timer callbacks after the expiration tick." },
+				};
+
+				const auto flags = out.flags();
+				out << std::dec << std::noshowpos;
+
+				for (const auto &v : values)
+				{
+					out << "# HELP " << v.name << ' ' << v.help << "\n# TYPE " << v.name << ' ' << v.type << '\n'
+						<< v.name << ' ' << snapshot[v.m] << '\n';
+				}
+
+				for (const auto &h : histograms)
+				{
+					const auto &data = snapshot[h.m];
+					out << "# HELP " << h.name << ' ' << h.help << "\n# TYPE " << h.name << " histogram\n";
+					// power of two bucket boundaries are exact boundaries of the log-linear buckets
+					uint64_t cumulative = 0;
+					size_t bucket = 0;
+					for (unsigned exponent = histogram_snapshot::sub_bits; exponent < histogram_snapshot::max_exponent; ++exponent)
+					{
+						const auto bound = uint64_t{ 1 } << exponent;
+						for (; histogram_snapshot::lower_bound(bucket) < bound; ++bucket)
+							cumulative += data.buckets[bucket];
+						out << h.name << "_bucket{le=\"";
+						write_seconds(out, bound);
+						out << "\"} " << cumulative << '\n';
+					}
+					out << h.name << "_bucket{le=\"+Inf\"} " << data.count << '\n'
+						<< h.name << "_sum ";
+					write_seconds(out, data.sum);
+					out << '\n' << h.name << "_count " << data.count << '\n';
+				}
+				out.flags(flags);
+			}
+		};
+
+		inline void add_metric(metric m, int64_t delta = 1) noexcept
+		{
+			runtime_metrics::add(m, delta);
+		}
+
+		inline void record_latency(latency_metric m, std::chrono::nanoseconds value) noexcept
+		{
+			runtime_metrics::record(m, value);
+		}
+
+		inline metrics_snapshot get_metrics_snapshot() noexcept
+		{
+			return runtime_metrics::snapshot();
+		}
+
+		inline void write_prometheus(std::ostream &out, const metrics_snapshot &snapshot = get_metrics_snapshot())
+		{
+			runtime_metrics::write_prometheus(out, snapshot);
+		}
+#else
+		constexpr bool metrics_enabled = false;
+
+		inline void add_metric(metric, int64_t = 1) noexcept
+		{
+		}
+
+		inline void record_latency(latency_metric, std::chrono::nanoseconds) noexcept
+		{
+		}
+#endif
+
+		// Stall watchdog
+		// Define CPPWINRT_EX_ENABLE_WATCHDOG to let a stall_watchdog detect continuations that block the thread that has
+		// delivered a completion (timer callbacks, I/O completions, thread pool work items) and futures that are awaited for
+		// longer than a deadline. Time is measured in ticks advanced by the watchdog thread, so marking a resume costs a
+		// relaxed load and two stores to a per-thread slot. A coroutine that suspends on a future links a node embedded in the
+		// promise into one of 64 striped lists while a watchdog is running. Without the macro, the hooks compile to nothing.
+		// The macro changes the layout of promises and must be defined the same way in all translation units.
+#if defined(CPPWINRT_EX_ENABLE_WATCHDOG)
+		constexpr bool watchdog_enabled = true;
+
+		struct stall_report
+		{
+			enum class kind_t
+			{
+				long_resume,		// a continuation runs longer than the resume threshold
+				long_suspension,	// a coroutine waits for a future longer than the suspension deadline
+			};
+
+			kind_t kind;
+			const char *site;			// "timer", "io", "thread_pool" or "future"
+			const void *object;			// timer context, I/O operation, coroutine frame or future's promise
+			std::thread::id thread;		// thread running the continuation or thread the coroutine has suspended on
+			std::chrono::milliseconds duration;	// time elapsed when the stall was detected, with the watchdog's period resolution
+		};
+
+		// linked into the watchdog while a coroutine waits for a future
+		struct suspension_node
+		{
+			suspension_node *prev{ nullptr };
+			suspension_node *next{ nullptr };
+			const void *object{ nullptr };
+			uint64_t since{ 0 };
+			std::thread::id thread;
+			bool linked{ false };
+			bool reported{ false };
+		};
+
+		class stall_watchdog
+		{
+			friend class watchdog_scope;
+
+			static constexpr size_t stripe_count = 64;
+
+			// resume currently running on a thread; started is the tick the resume has started at, 0 when idle
+			struct thread_slot
+			{
+				thread_slot *next{ nullptr };
+				std::atomic<bool> in_use{ true };
+				std::atomic<std::thread::id> thread{};
+				std::atomic<uint64_t> started{ 0 };
+				std::atomic<const void *> object{ nullptr };
+				std::atomic<const char *> site{ nullptr };
+				unsigned depth{ 0 };		// owning thread only
+				uint64_t reported{ 0 };		// watchdog thread only
+			};
+
+			struct owner
+			{
+				thread_slot *current{ nullptr };
+
+				~owner()
+				{
+					if (current)
+					{
+						current->started.store(0, std::memory_order_relaxed);
+						current->in_use.store(false, std::memory_order_release);
+					}
+				}
+			};
+
+			struct stripe
+			{
+				spinlock lock;
+				waiter_list<suspension_node> nodes;
+			};
+
+			struct shared_state
+			{
+				std::atomic<uint64_t> tick{ 1 };
+				std::atomic<bool> active{ false };
+				std::atomic<thread_slot *> slots{ nullptr };
+				stripe stripes[stripe_count];
+			};
+
+			static shared_state &global() noexcept
+			{
+				static shared_state instance;
+				return instance;
+			}
+
+			static stripe &stripe_of(const suspension_node *node) noexcept
+			{
+				return global().stripes[(reinterpret_cast<uintptr_t>(node) >> 6) % stripe_count];
+			}
+
+			// reuses a slot of an exited thread or allocates a new one
+			static thread_slot *acquire() noexcept
+			{
+				auto &head = global().slots;
+				thread_slot *slot = nullptr;
+				for (auto current = head.load(std::memory_order_acquire); current && !slot; current = current->next)
+				{
+					bool expected = false;
+					if (!current->in_use.load(std::memory_order_relaxed) && current->in_use.compare_exchange_strong(expected, true, std::memory_order_acquire))
+						slot = current;
+				}
+
+				if (!slot)
+				{
+					slot = new (std::nothrow) thread_slot{};
+					if (!slot)
+						return nullptr;
+					slot->thread.store(std::this_thread::get_id(), std::memory_order_relaxed);
+					slot->next = head.load(std::memory_order_relaxed);
+					while (!head.compare_exchange_weak(slot->next, slot, std::memory_order_release, std::memory_order_relaxed))
+						;
+				}
+				else
+					slot->thread.store(std::this_thread::get_id(), std::memory_order_relaxed);
+				return slot;
+			}
+
+			static thread_slot *local() noexcept
+			{
+				thread_local owner instance;
+				if (!instance.current)
+					instance.current = acquire();
+				return instance.current;
+			}
+
+			const std::chrono::milliseconds period;
+			const uint64_t resume_ticks;
+			const uint64_t suspension_ticks;
+			void (*const report)(const stall_report &, void *context) noexcept;
+			void *const context;
+
+			std::mutex lock;
+			std::condition_variable wake;
+			bool stopping{ false };
+			std::vector<stall_report> reports;
+			std::thread thread;
+
+			std::chrono::milliseconds elapsed(uint64_t now, uint64_t since) const noexcept
+			{
+				return period * static_cast<int64_t>(now - since);
+			}
+
+			void scan(uint64_t now)
+			{
+				auto &g = global();
+				for (auto slot = g.slots.load(std::memory_order_acquire); slot; slot = slot->next)
+				{
+					const auto started = slot->started.load(std::memory_order_acquire);
+					if (started && started != slot->reported && now - started >= resume_ticks)
+					{
+						slot->reported = started;
+						reports.push_back({ stall_report::kind_t::long_resume, slot->site.load(std::memory_order_relaxed), slot->object.load(std::memory_order_relaxed),
+							slot->thread.load(std::memory_order_relaxed), elapsed(now, started) });
+					}
+				}
+
+				for (auto &s : g.stripes)
+				{
+					const std::lock_guard<spinlock> l(s.lock);
+					for (auto node = s.nodes.front(); node; node = node->next)
+					{
+						if (!node->reported && now - node->since >= suspension_ticks)
+						{
+							node->reported = true;
+							reports.push_back({ stall_report::kind_t::long_suspension, "future", node->object, node->thread, elapsed(now, node->since) });
+						}
+					}
+				}
+			}
+
+			void run() noexcept
+			{
+				std::unique_lock<std::mutex> l(lock);
+				while (!wake.wait_for(l, period, [this] { return stopping; }))
+				{
+					l.unlock();
+					const auto now = global().tick.fetch_add(1, std::memory_order_relaxed) + 1;
+					try
+					{
+						scan(now);
+					}
+					catch (...)
+					{
+					}
+					for (const auto &r : reports)
+						report(r, context);
+					reports.clear();
+					l.lock();
+				}
+			}
+
+		public:
+			// Starts the watchdog thread. report is called on that thread once for every detected stall. Only one watchdog
+			// may run at a time.
+			stall_watchdog(std::chrono::milliseconds resume_threshold, std::chrono::milliseconds suspension_deadline,
+				void (*report)(const stall_report &, void *context) noexcept, void *context = nullptr) :
+				period{ (std::max)(std::chrono::milliseconds{ 1 }, (std::min)(resume_threshold, suspension_deadline) / 4) },
+				resume_ticks{ static_cast<uint64_t>((std::max)(int64_t{ 1 }, static_cast<int64_t>((resume_threshold + period - std::chrono::milliseconds{ 1 }) / period))) },
+				suspension_ticks{ static_cast<uint64_t>((std::max)(int64_t{ 1 }, static_cast<int64_t>((suspension_deadline + period - std::chrono::milliseconds{ 1 }) / period))) },
+				report{ report },
+				context{ context }
+			{
+				bool expected = false;
+				if (!global().active.compare_exchange_strong(expected, true))
+					throw std::logic_error("only one stall_watchdog may run at a time");
+				try
+				{
+					thread = std::thread{ [this] { run(); } };
+				}
+				catch (...)
+				{
+					global().active.store(false);
+					throw;
+				}
+			}
+
+			stall_watchdog(const stall_watchdog &) = delete;
+			stall_watchdog &operator =(const stall_watchdog &) = delete;
+
+			~stall_watchdog()
+			{
+				{
+					const std::lock_guard<std::mutex> l(lock);
+					stopping = true;
+				}
+				wake.notify_one();
+				thread.join();
+				global().active.store(false);
+			}
+
+			// called before a coroutine publishes its suspension on a future
+			static void suspended(suspension_node &node, const void *object) noexcept
+			{
+				auto &g = global();
+				if (node.linked || !g.active.load(std::memory_order_relaxed))
+					return;
+				node.object = object;
+				node.since = g.tick.load(std::memory_order_relaxed);
+				node.thread = std::this_thread::get_id();
+				node.reported = false;
+				auto &s = stripe_of(&node);
+				const std::lock_guard<spinlock> l(s.lock);
+				s.nodes.push_back(&node);
+				node.linked = true;
+			}
+
+			// called when the future completes or the coroutine does not suspend after all
+			static void resumed(suspension_node &node) noexcept
+			{
+				if (!node.linked)
+					return;
+				auto &s = stripe_of(&node);
+				const std::lock_guard<spinlock> l(s.lock);
+				s.nodes.remove(&node);
+				node.linked = false;
+			}
+		};
+
+		// marks the current thread as running a continuation for the scope's lifetime
+		class watchdog_scope
+		{
+			stall_watchdog::thread_slot *slot;
+
+		public:
+			watchdog_scope(const char *site, const void *object) noexcept :
+				slot{ stall_watchdog::local() }
+			{
+				if (slot && 0 == slot->depth++)
+				{
+					slot->object.store(object, std::memory_order_relaxed);
+					slot->site.store(site, std::memory_order_relaxed);
+					slot->started.store(stall_watchdog::global().tick.load(std::memory_order_relaxed), std::memory_order_release);
+				}
+			}
+
+			watchdog_scope(const watchdog_scope &) = delete;
+			watchdog_scope &operator =(const watchdog_scope &) = delete;
+
+			~watchdog_scope()
+			{
+				if (slot && 0 == --slot->depth)
+					slot->started.store(0, std::memory_order_release);
+			}
+		};
+#else
+		constexpr bool watchdog_enabled = false;
+
+		class watchdog_scope
+		{
+		public:
+			watchdog_scope(const char *, const void *) noexcept
+			{
+			}
+		};
+#endif
+
+		enum class status_t
+		{
+			running,
+			ready,
+			exception
+		};
+
+		// Promise state word: low bits hold status_t, higher bits are flags that are only ever set.
+		// Every transition is a single atomic read-modify-write, so completing, awaiting and releasing a future never takes a lock.
+		enum state_flags : unsigned
+		{
+			status_mask = 0x03,
+			awaiter_registered = 0x04,	// continuation handle has been published
+			final_suspended = 0x08,		// coroutine has reached its final suspend point
+			future_detached = 0x10,		// last future referencing the promise has been released
+			cancel_requested = 0x20,	// future<T>::cancel has been called
+			blocking_waiter = 0x40,		// a thread is blocked in future<T>::wait and must be woken on completion
+		};
+
+		// Continuation of an asynchronous operation: either a coroutine or a callback that returns a coroutine to resume (or null).
+		// Library awaitables accept it in await_suspend in place of a coroutine handle, which allows combinators to wait for
+		// them without a coroutine frame per child.
+		class continuation
+		{
+		public:
+			using callback_t = coro::coroutine_handle<> (*)(void *context) noexcept;
+
+		private:
+			callback_t callback{ nullptr };
+			void *context{ nullptr };
+
+			static coro::coroutine_handle<> from_address(void *address) noexcept
+			{
+				return coro::coroutine_handle<>::from_address(address);
+			}
+
+		public:
+			continuation() noexcept = default;
+
+			continuation(coro::coroutine_handle<> handle) noexcept :
+				callback{ &from_address },
+				context{ handle.address() }
+			{}
+
+			continuation(callback_t callback, void *context) noexcept :
+				callback{ callback },
+				context{ context }
+			{}
+
+			explicit operator bool() const noexcept
+			{
+				return callback != nullptr;
+			}
+
+			// returns the coroutine to resume
+			coro::coroutine_handle<> get() const noexcept
+			{
+				return callback(context);
+			}
+
+			void operator()() const
+			{
+				if (auto handle = get())
+					handle.resume();
+			}
+		};
+
+		// detect awaiters that support continuation protocol
+		template<class, class = std::void_t<>>
+		struct accepts_continuation : std::false_type {};
+
+		template<class T>
+		struct accepts_continuation<T, std::void_t<decltype(std::declval<T &>().await_suspend(std::declval<continuation>()))>> : std::true_type {};
+
+		template<class T>
+		constexpr bool accepts_continuation_v = accepts_continuation<T>::value;
+
+		// Shared state of a cancellation source and its tokens
+		// Callbacks are kept in an intrusive list. A callback registered after cancellation has been requested is invoked
+		// immediately. Removing a registration waits for its callback if it is running on another thread.
+		class cancellation_state
+		{
+		public:
+			using callback_t = void (*)(void *context) noexcept;
+
+			struct registration
+			{
+				callback_t callback;
+				void *context;
+				registration *prev{ nullptr };
+				registration *next{ nullptr };
+				bool linked{ false };
+				bool *removed_by_callback{ nullptr };
+				std::atomic<bool> done{ false };
+
+				registration(callback_t callback, void *context) noexcept :
+					callback{ callback },
+					context{ context }
+				{}
+			};
+
+		private:
+			std::atomic<size_t> references{ 1 };
+			std::atomic<bool> requested{ false };
+			srwlock lock;
+			registration *head{ nullptr };
+			registration *executing{ nullptr };
+			std::thread::id requester;
+
+			void unlink(registration *r) noexcept
+			{
+				if (r->prev)
+					r->prev->next = r->next;
+				else
+					head = r->next;
+				if (r->next)
+					r->next->prev = r->prev;
+				r->prev = r->next = nullptr;
+				r->linked = false;
+			}
+
+		public:
+			void add_ref() noexcept
+			{
+				references.fetch_add(1, std::memory_order_relaxed);
+			}
+
+			void release() noexcept
+			{
+				if (1 == references.fetch_sub(1, std::memory_order_acq_rel))
+					delete this;
+			}
+
+			bool is_requested() const noexcept
+			{
+				return requested.load(std::memory_order_acquire);
+			}
+
+			// returns false if cancellation has already been requested
+			bool request() noexcept
+			{
+				{
+					const std::lock_guard<srwlock> l(lock);
+					if (requested.load(std::memory_order_relaxed))
+						return false;
+					requested.store(true, std::memory_order_release);
+					requester = std::this_thread::get_id();
+				}
+
+				for (;;)
+				{
+					registration *r;
+					{
+						const std::lock_guard<srwlock> l(lock);
+						executing = nullptr;
+						r = head;
+						if (!r)
+							return true;
+						unlink(r);
+						executing = r;
+					}
+
+					bool removed = false;
+					r->removed_by_callback = &removed;
+					r->callback(r->context);
+					if (!removed)
+					{
+						r->removed_by_callback = nullptr;
+						r->done.store(true, std::memory_order_release);
+					}
+				}
+			}
+
+			void add(registration *r) noexcept
+			{
+				{
+					const std::lock_guard<srwlock> l(lock);
+					if (!requested.load(std::memory_order_relaxed))
+					{
+						r->next = head;
+						if (head)
+							head->prev = r;
+						head = r;
+						r->linked = true;
+						return;
+					}
+				}
+				// nobody waits for this callback: the registration is neither linked nor executing
+				r->callback(r->context);
+			}
+
+			void remove(registration *r) noexcept
+			{
+				{
+					const std::lock_guard<srwlock> l(lock);
+					if (r->linked)
+					{
+						unlink(r);
+						return;
+					}
+					if (executing != r)
+						return;
+					if (requester == std::this_thread::get_id())
+					{
+						// removed from its own callback
+						*r->removed_by_callback = true;
+						return;
+					}
+				}
+				while (!r->done.load(std::memory_order_acquire))
+					std::this_thread::yield();
+			}
+		};
+
+		// Observes cancellation requests of a cancellation_source. A default-constructed token is never cancelled.
+		class cancellation_token
+		{
+			friend class cancellation_source;
+			friend class cancellation_registration;
+			friend struct promise_base0;
+
+			cancellation_state *state{ nullptr };
+
+			explicit cancellation_token(cancellation_state *state) noexcept :
+				state{ state }
+			{
+				if (state)
+					state->add_ref();
+			}
+
+		public:
+			cancellation_token() noexcept = default;
+
+			cancellation_token(const cancellation_token &o) noexcept :
+				cancellation_token{ o.state }
+			{}
+
+			cancellation_token(cancellation_token &&o) noexcept :
+				state{ o.state }
+			{
+				o.state = nullptr;
+			}
+
+			cancellation_token &operator =(cancellation_token o) noexcept
+			{
+				std::swap(state, o.state);
+				return *this;
+			}
+
+			~cancellation_token()
+			{
+				if (state)
+					state->release();
+			}
+
+			bool can_be_cancelled() const noexcept
+			{
+				return state != nullptr;
+			}
+
+			bool is_cancellation_requested() const noexcept
+			{
+				return state && state->is_requested();
+			}
+
+			void throw_if_cancellation_requested() const
+			{
+				if (is_cancellation_requested())
+					throw_canceled();
+			}
+		};
+
+		// Requests cancellation of operations that observe its tokens. Copies share the same state.
+		class cancellation_source
+		{
+			cancellation_state *state;
+
+		public:
+			cancellation_source() :
+				state{ new cancellation_state{} }
+			{}
+
+			cancellation_source(const cancellation_source &o) noexcept :
+				state{ o.state }
+			{
+				state->add_ref();
+			}
+
+			cancellation_source &operator =(const cancellation_source &o) noexcept
+			{
+				o.state->add_ref();
+				state->release();
+				state = o.state;
+				return *this;
+			}
+
+			~cancellation_source()
+			{
+				state->release();
+			}
+
+			cancellation_token get_token() const noexcept
+			{
+				return cancellation_token{ state };
+			}
+
+			// invokes registered callbacks on the calling thread, returns false if cancellation has already been requested
+			bool request_cancellation() noexcept
+			{
+				return state->request();
+			}
+
+			bool is_cancellation_requested() const noexcept
+			{
+				return state->is_requested();
+			}
+		};
+
+		// Invokes a callback when cancellation is requested through a token
+		// The callback may be invoked from set() if cancellation has already been requested. reset() and the destructor wait
+		// for a callback running on another thread.
+		class cancellation_registration
+		{
+			cancellation_state::registration node;
+			cancellation_token token;
+
+		public:
+			cancellation_registration(cancellation_state::callback_t callback, void *context) noexcept :
+				node{ callback, context }
+			{}
+
+			cancellation_registration(const cancellation_registration &) = delete;
+			cancellation_registration &operator =(const cancellation_registration &) = delete;
+
+			~cancellation_registration()
+			{
+				reset();
+			}
+
+			void set(const cancellation_token &token_) noexcept
+			{
+				reset();
+				if (token_.state)
+				{
+					token = token_;
+					node.done.store(false, std::memory_order_relaxed);
+					token.state->add(&node);
+				}
+			}
+
+			void reset() noexcept
+			{
+				if (token.state)
+				{
+					token.state->remove(&node);
+					token = {};
+				}
+			}
+		};
+
+		// detect awaitables that support cancellation
+		template<class, class = std::void_t<>>
+		struct is_cancellable : std::false_type {};
+
+		template<class T>
+		struct is_cancellable<T, std::void_t<decltype(std::declval<T &>().cancel())>> : std::true_type {};
+
+		template<class T>
+		constexpr bool is_cancellable_v = is_cancellable<T>::value;
+
+		// Orders completion events of an awaiter, such as timer expiration and cancellation, against its own await_suspend.
+		// The first event claims the completion. It resumes the coroutine, unless await_suspend has not returned yet, in which
+		// case the coroutine does not suspend.
+		class completion_latch
+		{
+			static constexpr unsigned claimed = 0x01;
+			static constexpr unsigned completed = 0x02;
+			static constexpr unsigned suspended = 0x04;
+
+			std::atomic<unsigned> state{ 0 };
+
+		public:
+			void reset() noexcept
+			{
+				state.store(0, std::memory_order_relaxed);
+			}
+
+			// returns true for the first event
+			bool try_claim() noexcept
+			{
+				return 0 == (state.fetch_or(claimed, std::memory_order_acq_rel) & claimed);
+			}
+
+			// called by the event that has claimed the completion, returns true if it has to resume the coroutine
+			bool complete() noexcept
+			{
+				return 0 != (state.fetch_or(completed, std::memory_order_acq_rel) & suspended);
+			}
+
+			// called at the end of await_suspend, returns false if the coroutine must not suspend
+			bool suspend() noexcept
+			{
+				return 0 == (state.fetch_or(suspended, std::memory_order_acq_rel) & completed);
+			}
+		};
+
+		struct promise_base0
+		{
+			std::atomic<unsigned> state{ static_cast<unsigned>(status_t::running) };
+			continuation resume{};
+			std::exception_ptr exception;
+			std::atomic<int> use_count{ 1 };
+			std::atomic<cancellation_state *> cancellation{ nullptr };	// created when the coroutine asks for its token
+			bool resume_pending{ false };	// continuation was registered before completion and is resumed at final suspend
+#if defined(CPPWINRT_EX_ENABLE_WATCHDOG)
+			suspension_node suspension;
+#endif
+
+			~promise_base0()
+			{
+#if defined(CPPWINRT_EX_ENABLE_WATCHDOG)
+				stall_watchdog::resumed(suspension);
+#endif
+				if (auto state_ = cancellation.load(std::memory_order_relaxed))
+					state_->release();
+			}
+
+			cancellation_state *get_cancellation_state()
+			{
+				auto current = cancellation.load(std::memory_order_acquire);
+				if (!current)
+				{
+					auto created = new cancellation_state{};
+					if (cancellation.compare_exchange_strong(current, created))
+					{
+						current = created;
+						// cancellation may have been requested before the state existed
+						if (state.load() & cancel_requested)
+							current->request();
+					}
+					else
+						created->release();
+				}
+				return current;
+			}
+
+			cancellation_token get_cancellation_token()
+			{
+				return cancellation_token{ get_cancellation_state() };
+			}
+
+			// does not allocate: if the coroutine has not asked for its token yet, it gets a cancelled one
+			void request_cancellation() noexcept
+			{
+				state.fetch_or(cancel_requested);
+				if (auto current = cancellation.load())
+					current->request();
+			}
+
+			status_t status() const noexcept
+			{
+				return static_cast<status_t>(state.load(std::memory_order_acquire) & status_mask);
+			}
+
+			bool is_ready() const noexcept
+			{
+				return status() != status_t::running;
+			}
+
+			// publish the result and wake blocked threads; a continuation registered before is resumed from final_suspend
+			void complete(status_t status_) noexcept
+			{
+				const auto previous = state.fetch_or(static_cast<unsigned>(status_), std::memory_order_acq_rel);
+				if (previous & blocking_waiter)
+					wake_by_address_all(state);
+				if (previous & awaiter_registered)
+					resume_pending = true;
+			}
+
+			// Blocks the calling thread until the result is available or the deadline passes, returns true if it is available.
+			// Spins up to spin_count iterations first. Blocking waiters sleep on the state word itself, so they neither
+			// allocate nor use the continuation slot.
+			bool wait_ready(unsigned spin_count, const std::chrono::steady_clock::time_point *deadline = nullptr) noexcept
+			{
+				for (unsigned i = 0; i < spin_count; ++i)
+				{
+					if (is_ready())
+						return true;
+					cpu_relax();
+				}
+
+				auto value = state.fetch_or(blocking_waiter, std::memory_order_acq_rel) | blocking_waiter;
+				while ((value & status_mask) == static_cast<unsigned>(status_t::running))
+				{
+					if (deadline)
+					{
+						const auto now = std::chrono::steady_clock::now();
+						if (now >= *deadline)
+							return false;
+						const std::chrono::nanoseconds remaining{ *deadline - now };
+						wait_on_address(state, value, &remaining);
+					}
+					else
+						wait_on_address(state, value);
+					value = state.load(std::memory_order_acquire);
+				}
+				return true;
+			}
+
+			// returns false if the result is already available and the caller must not suspend
+			bool start_async(continuation resume_) noexcept
+			{
+				resume = resume_;
+#if defined(CPPWINRT_EX_ENABLE_WATCHDOG)
+				// linked before the suspension is published, so that the completing thread finds it
+				stall_watchdog::suspended(suspension, this);
+#endif
+				if (state.fetch_or(awaiter_registered, std::memory_order_acq_rel) & status_mask)
+				{
+#if defined(CPPWINRT_EX_ENABLE_WATCHDOG)
+					stall_watchdog::resumed(suspension);
+#endif
+					return false;
+				}
+				trace(trace_event::future_suspended, this);
+				return true;
+			}
+
+			void set_exception(std::exception_ptr exception_)
+			{
+				exception = exception_;
+				complete(status_t::exception);
+			}
+
+			void unhandled_exception()
+			{
+				set_exception(std::current_exception());
+			}
+
+			void check_exception()
+			{
+				assert(is_ready());
+				if (status() == status_t::exception && exception)
+					std::rethrow_exception(exception);
+			}
+		};
+
+		template<class T>
+		struct promise_base : promise_base0
+		{
+			// the value is constructed directly from co_return and only exists once the status is ready
+			alignas(T) unsigned char storage[sizeof(T)];
+
+			promise_base() noexcept = default;
+			promise_base(const promise_base &) = delete;
+			promise_base &operator =(const promise_base &) = delete;
+
+			~promise_base()
+			{
+				if (status() == status_t::ready)
+					value().~T();
+			}
+
+			T &value() noexcept
+			{
+				return *std::launder(reinterpret_cast<T *>(storage));
+			}
+
+			template<class V = T>
+			void return_value(V &&v)
+			{
+				::new (static_cast<void *>(storage)) T(std::forward<V>(v));
+				complete(status_t::ready);
+			}
+
+			T &get()
+			{
+				check_exception();
+				return value();
+			}
+		};
+
+		template<>
+		struct promise_base<void> : promise_base0
+		{
+			void return_void()
+			{
+				complete(status_t::ready);
+			}
+
+			struct empty_type {};
+
+			empty_type get()
+			{
+				check_exception();
+				return {};
+			}
+		};
+
+		template<class T>
+		class future_base
+		{
+		protected:
+			const T &iget(T &value) const &
+			{
+				return value;
+			}
+
+			T &&iget(T &value) &&
+			{
+				return std::move(value);
+			}
+		};
+
+		template<>
+		class future_base<void>
+		{
+		protected:
+			template<class T>
+			void iget(T &&)
+			{
+			}
+		};
+
+		template<class T>
+		class shared_future;
+
+		template<class T>
+		class future : public future_base<T>
+		{
+			static_assert(!std::is_reference_v<T>, "future<T> is not allowed for reference types");
+			struct promise_type_ : promise_base<T>, frame_allocated
+			{
+				promise_type_() noexcept
+				{
+					trace(trace_event::future_created, static_cast<promise_base0 *>(this));
+					add_metric(metric::futures_alive);
+				}
+
+				~promise_type_()
+				{
+					trace(trace_event::future_destroyed, static_cast<promise_base0 *>(this));
+					add_metric(metric::futures_alive, -1);
+				}
+
+				static coro::suspend_never initial_suspend() noexcept
+				{
+					return {};
+				}
+
+				auto final_suspend() noexcept
+				{
+					struct awaiter
+					{
+						promise_type_ *pthis;
+
+						static bool await_ready() noexcept
+						{
+							return false;
+						}
+
+						// The continuation is resumed by symmetric transfer, so a chain of completions runs in constant stack depth.
+						// The frame stays suspended while a future still references the promise, otherwise it is freed here.
+						// The continuation is obtained first: a combinator callback may release the future.
+						coro::coroutine_handle<> await_suspend(coro::coroutine_handle<> handle) const noexcept
+						{
+							trace(trace_event::future_completed, static_cast<promise_base0 *>(pthis));
+							if (pthis->resume_pending)
+							{
+								trace(trace_event::future_resumed, static_cast<promise_base0 *>(pthis));
+#if defined(CPPWINRT_EX_ENABLE_WATCHDOG)
+								stall_watchdog::resumed(pthis->suspension);
+#endif
+							}
+							const auto next = pthis->resume_pending ? pthis->resume.get() : coro::coroutine_handle<>{};
+							if (pthis->state.fetch_or(final_suspended, std::memory_order_acq_rel) & future_detached)
+								handle.destroy();
+							return or_noop(next);
+						}
+
+						static void await_resume() noexcept
+						{
+						}
+					};
+					return awaiter{ this };
+				}
+
+				future<T> get_return_object() noexcept
+				{
+					return { this };
+				}
+
+				void add_ref() noexcept
+				{
+					this->use_count.fetch_add(1, std::memory_order_relaxed);
+				}
+
+				void release() noexcept
+				{
+					if (1 == this->use_count.fetch_sub(1, std::memory_order_acq_rel))
+						destroy();
+				}
+
+				void destroy() noexcept
+				{
+					if (this->state.fetch_or(future_detached, std::memory_order_acq_rel) & final_suspended)
+						coro::coroutine_handle<promise_type_>::from_promise(*this).destroy();
+				}
+			};
+
+			promise_type_ *promise;
+
+			future(promise_type_ *promise) noexcept :
+				promise{ promise }
+			{}
+
+		public:
+			using promise_type = promise_type_;
+
+			~future()
+			{
+				if (promise)
+					promise->release();
+			}
+
+			future(const future &o) noexcept :
+			promise{ o.promise }
+			{
+				if (promise)
+					promise->add_ref();
+			}
+
+			future &operator =(const future &o) noexcept
+			{
+				if (o.promise)
+					o.promise->add_ref();
+				if (promise)
+					promise->release();
+				promise = o.promise;
+				return *this;
+			}
+
+			future(future &&o) noexcept :
+				promise{ o.promise }
+			{
+				o.promise = nullptr;
+			}
+
+			future &operator =(future &&o) noexcept
+			{
+				using std::swap;
+				swap(promise, o.promise);
+				return *this;
+			}
+
+			// blocks until the result is available; spin_count bounds the busy-wait that precedes blocking
+			void wait(unsigned spin_count = 0) const noexcept
+			{
+				promise->wait_ready(spin_count);
+			}
+
+			// returns true if the result became available within the timeout
+			template<class Rep, class Period>
+			bool wait_for(const std::chrono::duration<Rep, Period> &timeout) const noexcept
+			{
+				const auto deadline = std::chrono::steady_clock::now() + std::chrono::ceil<std::chrono::steady_clock::duration>(timeout);
+				return promise->wait_ready(0, &deadline);
+			}
+
+			// returns true if the result became available before the deadline
+			template<class Clock, class Duration>
+			bool wait_until(const std::chrono::time_point<Clock, Duration> &deadline) const noexcept
+			{
+				if constexpr (std::is_same_v<Clock, std::chrono::steady_clock>)
+				{
+					const auto steady_deadline = std::chrono::time_point_cast<std::chrono::steady_clock::duration>(deadline);
+					return promise->wait_ready(0, &steady_deadline);
+				}
+				else
+					return wait_for(deadline - Clock::now());
+			}
+
+			decltype(auto) get(unsigned spin_count = 0)
+			{
+				wait(spin_count);
+				return this->iget(promise->get());
+			}
+
+			// requests cancellation of the coroutine, which observes it through co_await get_cancellation_token()
+			void cancel() noexcept
+			{
+				promise->request_cancellation();
+			}
+
+			// transfers the result into a shared_future that may be awaited by any number of coroutines
+			shared_future<T> share()
+			{
+				return shared_future<T>{ std::move(*this) };
+			}
+
+			// await
+			bool await_ready() const
+			{
+				return promise->is_ready();
+			}
+
+			bool await_suspend(coro::coroutine_handle<> resume)
+			{
+				return promise->start_async(resume);
+			}
+
+			bool await_suspend(continuation resume)
+			{
+				return promise->start_async(resume);
+			}
+
+			void iawait_resume(std::true_type)
+			{
+				promise->get();
+			}
+
+			decltype(auto) iawait_resume(std::false_type)
+			{
+				return std::move(promise->get());
+			}
+
+			decltype(auto) await_resume()
+			{
+				return iawait_resume(std::is_same<T, void>{});
+			}
+		};
+		
+		// co_await get_cancellation_token() in a future<T> coroutine produces a token cancelled by future<T>::cancel()
+		class get_cancellation_token
+		{
+			cancellation_token token;
+
+		public:
+			static bool await_ready() noexcept
+			{
+				return false;
+			}
+
+			template<class Promise>
+			bool await_suspend(coro::coroutine_handle<Promise> handle)
+			{
+				token = handle.promise().get_cancellation_token();
+				return false;
+			}
+
+			cancellation_token await_resume() noexcept
+			{
+				return std::move(token);
+			}
+		};
+
+		// Lazy task
+		// The coroutine starts when the task is awaited and resumes the awaiting coroutine by symmetric transfer when it
+		// completes. A task is move-only, awaited once and owns its frame, so no reference counting or atomic state is
+		// needed. Combinators start a task from their start loop and are notified through a continuation.
+		template<class T>
+		struct task_promise_base
+		{
+			std::optional<T> value;
+			std::exception_ptr exception;
+
+			template<class V = T>
+			void return_value(V &&v)
+			{
+				value.emplace(std::forward<V>(v));
+			}
+
+			T get()
+			{
+				if (exception)
+					std::rethrow_exception(exception);
+				return std::move(*value);
+			}
+		};
+
+		template<>
+		struct task_promise_base<void>
+		{
+			std::exception_ptr exception;
+
+			static void return_void() noexcept
+			{
+			}
+
+			void get()
+			{
+				if (exception)
+					std::rethrow_exception(exception);
+			}
+		};
+
+		template<class T>
+		class task
+		{
+			static_assert(!std::is_reference_v<T>, "task<T> is not allowed for reference types");
+
+		public:
+			struct promise_type : task_promise_base<T>, frame_allocated
+			{
+				continuation resume;
+
+				task get_return_object() noexcept
+				{
+					return task{ coro::coroutine_handle<promise_type>::from_promise(*this) };
+				}
+
+				static coro::suspend_always initial_suspend() noexcept
+				{
+					return {};
+				}
+
+				static auto final_suspend() noexcept
+				{
+					struct awaiter
+					{
+						static bool await_ready() noexcept
+						{
+							return false;
+						}
+
+						// the frame stays suspended until the task is destroyed
+						static coro::coroutine_handle<> await_suspend(coro::coroutine_handle<promise_type> handle) noexcept
+						{
+							return or_noop(handle.promise().resume.get());
+						}
+
+						static void await_resume() noexcept
+						{
+						}
+					};
+					return awaiter{};
+				}
+
+				void unhandled_exception() noexcept
+				{
+					this->exception = std::current_exception();
+				}
+			};
+
+		private:
+			coro::coroutine_handle<promise_type> handle;
+
+			explicit task(coro::coroutine_handle<promise_type> handle) noexcept :
+				handle{ handle }
+			{}
+
+		public:
+			task() noexcept = default;
+
+			task(task &&o) noexcept :
+				handle{ std::exchange(o.handle, nullptr) }
+			{}
+
+			task &operator =(task &&o) noexcept
+			{
+				if (this != &o)
+				{
+					if (handle)
+						handle.destroy();
+					handle = std::exchange(o.handle, nullptr);
+				}
+				return *this;
+			}
+
+			~task()
+			{
+				if (handle)
+					handle.destroy();
+			}
+
+			explicit operator bool() const noexcept
+			{
+				return static_cast<bool>(handle);
+			}
+
+			// await
+			bool await_ready() const noexcept
+			{
+				return handle.done();
+			}
+
+			// starts the task, which continues the awaiting coroutine when it completes
+			coro::coroutine_handle<> await_suspend(coro::coroutine_handle<> resume) noexcept
+			{
+				handle.promise().resume = continuation{ resume };
+				return handle;
+			}
+
+			// runs the task up to its first suspension; the continuation may be invoked before this returns
+			bool await_suspend(continuation resume) noexcept
+			{
+				handle.promise().resume = resume;
+				handle.resume();
+				return true;
+			}
+
+			T await_resume()
+			{
+				return handle.promise().get();
+			}
+		};
+
+		// Asynchronous generator
+		// The producer coroutine co_yields values and may co_await anything in between, for example resumable_io_timeout
+		// reads. It starts when the consumer first asks for a value. With the default prefetch depth of 0, co_yield
+		// suspends the producer until the consumer pulls the next value. With a prefetch depth of N >= 1, the producer keeps
+		// running until N values are buffered, so its next read overlaps with processing of the current value, while
+		// memory stays bounded by N + 1 values.
+		// The consumer pulls values with co_await next() or iterates with co_await begin() and co_await ++it. Values are
+		// handed over by symmetric transfer. The producer is only resumed while the consumer is suspended: a refill runs it
+		// on to its next suspension point before the consumer continues with the value it has taken.
+		template<class T>
+		class async_generator
+		{
+			static_assert(!std::is_reference_v<T>, "async_generator<T> is not allowed for reference types");
+
+		public:
+			struct promise_type : frame_allocated
+			{
+				srwlock lock;
+				// values buffered ahead of the consumer; one inline slot unless a deeper prefetch is requested
+				std::optional<T> inline_slot;
+				std::unique_ptr<std::optional<T>[]> ring;
+				size_t capacity{ 1 };
+				size_t head{ 0 };
+				size_t buffered{ 0 };
+				size_t prefetch{ 0 };
+				coro::coroutine_handle<> consumer;
+				std::optional<T> current;
+				std::exception_ptr exception;
+				std::exception_ptr move_error;
+				bool taken{ false };
+				bool started{ false };
+				bool parked{ false };
+				bool done{ false };
+				bool abandoned{ false };
+
+				coro::coroutine_handle<promise_type> handle() noexcept
+				{
+					return coro::coroutine_handle<promise_type>::from_promise(*this);
+				}
+
+				std::optional<T> &slot(size_t index) noexcept
+				{
+					return ring ? ring[index % capacity] : inline_slot;
+				}
+
+				async_generator get_return_object() noexcept
+				{
+					return async_generator{ handle() };
+				}
+
+				static coro::suspend_always initial_suspend() noexcept
+				{
+					return {};
+				}
+
+				// hands the value to a waiting consumer, keeps running while fewer than prefetch values are buffered,
+				// otherwise parks until the consumer pulls
+				struct yield_awaiter
+				{
+					promise_type &promise;
+
+					static bool await_ready() noexcept
+					{
+						return false;
+					}
+
+					coro::coroutine_handle<> await_suspend(coro::coroutine_handle<promise_type> h) noexcept
+					{
+						promise.lock.lock();
+						if (promise.abandoned)
+						{
+							// the generator has been destroyed while the producer was running
+							promise.lock.unlock();
+							h.destroy();
+							return coro::noop_coroutine();
+						}
+						if (promise.consumer)
+						{
+							auto consumer = std::exchange(promise.consumer, nullptr);
+							promise.pop();
+							const bool refill = promise.buffered < promise.prefetch;
+							promise.parked = !refill;
+							promise.lock.unlock();
+
+							// both coroutines are suspended; this awaiter lives in the producer's frame and is gone once it resumes
+							if (refill)
+								h.resume();
+							return consumer;
+						}
+						const bool park = promise.buffered >= promise.prefetch;
+						promise.parked = park;
+						promise.lock.unlock();
+						if (park)
+							return coro::noop_coroutine();
+						return h;
+					}
+
+					static void await_resume() noexcept
+					{
+					}
+				};
+
+				template<class V = T>
+				yield_awaiter yield_value(V &&v)
+				{
+					{
+						std::lock_guard l{ lock };
+						slot(head + buffered).emplace(std::forward<V>(v));
+						++buffered;
+					}
+					return { *this };
+				}
+
+				static void return_void() noexcept
+				{
+				}
+
+				void unhandled_exception() noexcept
+				{
+					exception = std::current_exception();
+				}
+
+				static auto final_suspend() noexcept
+				{
+					struct awaiter
+					{
+						static bool await_ready() noexcept
+						{
+							return false;
+						}
+
+						static coro::coroutine_handle<> await_suspend(coro::coroutine_handle<promise_type> h) noexcept
+						{
+							auto &promise = h.promise();
+							promise.lock.lock();
+							if (promise.abandoned)
+							{
+								promise.lock.unlock();
+								h.destroy();
+								return coro::noop_coroutine();
+							}
+							promise.done = true;
+							auto next = std::exchange(promise.consumer, nullptr);
+							promise.lock.unlock();
+							return or_noop(next);
+						}
+
+						static void await_resume() noexcept
+						{
+						}
+					};
+					return awaiter{};
+				}
+
+				// moves the next buffered value to current for the suspended consumer; called with the lock held
+				// the cell is released even if T's move constructor throws, and the consumer receives the exception instead
+				void pop() noexcept
+				{
+					auto &front = slot(head);
+					head = (head + 1) % capacity;
+					--buffered;
+					try
+					{
+						current.emplace(std::move(*front));
+						taken = true;
+					}
+					catch (...)
+					{
+						move_error = std::current_exception();
+					}
+					front.reset();
+				}
+
+				// returns the value taken for the consumer, or nullptr once the producer has finished
+				T *take()
+				{
+					std::lock_guard l{ lock };
+					if (std::exchange(taken, false))
+						return std::addressof(*current);
+					current.reset();
+					if (move_error)
+						std::rethrow_exception(std::exchange(move_error, nullptr));
+					if (exception)
+						std::rethrow_exception(std::exchange(exception, nullptr));
+					return nullptr;
+				}
+			};
+
+		private:
+			coro::coroutine_handle<promise_type> handle;
+
+			explicit async_generator(coro::coroutine_handle<promise_type> handle) noexcept :
+				handle{ handle }
+			{}
+
+			void release() noexcept
+			{
+				if (!handle)
+					return;
+				auto &promise = handle.promise();
+				promise.lock.lock();
+				// a producer suspended on its own awaitable frees the frame when it reaches its next suspension point
+				const bool running = promise.started && !promise.parked && !promise.done;
+				if (running)
+					promise.abandoned = true;
+				promise.lock.unlock();
+				if (!running)
+					handle.destroy();
+				handle = nullptr;
+			}
+
+		public:
+			async_generator() noexcept = default;
+
+			async_generator(async_generator &&o) noexcept :
+				handle{ std::exchange(o.handle, nullptr) }
+			{}
+
+			async_generator &operator =(async_generator &&o) noexcept
+			{
+				if (this != &o)
+				{
+					release();
+					handle = std::exchange(o.handle, nullptr);
+				}
+				return *this;
+			}
+
+			~async_generator()
+			{
+				release();
+			}
+
+			explicit operator bool() const noexcept
+			{
+				return static_cast<bool>(handle);
+			}
+
+			// sets the number of values the producer may buffer ahead of the consumer; call before the first pull
+			// 0 runs the producer only on demand; 1 lets it produce one value while the consumer processes the current one
+			async_generator &prefetch(size_t depth)
+			{
+				auto &promise = handle.promise();
+				assert(!promise.started);
+				promise.prefetch = depth;
+				if (depth > 1)
+				{
+					promise.ring = std::make_unique<std::optional<T>[]>(depth);
+					promise.capacity = depth;
+				}
+				return *this;
+			}
+
+			// awaitable that produces a pointer to the next value, or nullptr when the producer has finished
+			// the value stays valid until the next pull
+			class next_awaiter
+			{
+			protected:
+				promise_type *promise;
+
+			public:
+				explicit next_awaiter(promise_type *promise) noexcept :
+					promise{ promise }
+				{}
+
+				static bool await_ready() noexcept
+				{
+					return false;
+				}
+
+				coro::coroutine_handle<> await_suspend(coro::coroutine_handle<> resume) noexcept
+				{
+					promise->lock.lock();
+					if (!promise->started)
+					{
+						promise->started = true;
+						promise->consumer = resume;
+						promise->lock.unlock();
+						return promise->handle();
+					}
+					if (promise->buffered)
+					{
+						promise->pop();
+						const bool refill = promise->parked && promise->buffered < promise->prefetch;
+						if (refill)
+							promise->parked = false;
+						promise->lock.unlock();
+
+						// the consumer is suspended, so the producer runs on to its next suspension point before it continues
+						if (refill)
+							promise->handle().resume();
+						return resume;
+					}
+					if (!promise->done)
+					{
+						promise->consumer = resume;
+						if (promise->parked)
+						{
+							promise->parked = false;
+							promise->lock.unlock();
+							return promise->handle();
+						}
+					}
+					const bool running = !promise->done;
+					promise->lock.unlock();
+					// a running producer hands over its next value
+					if (running)
+						return coro::noop_coroutine();
+					return resume;
+				}
+
+				T *await_resume()
+				{
+					return promise->take();
+				}
+			};
+
+			next_awaiter next() noexcept
+			{
+				return next_awaiter{ std::addressof(handle.promise()) };
+			}
+
+			// iteration: for (auto it = co_await g.begin(); it != g.end(); co_await ++it)
+			class iterator
+			{
+				friend class async_generator;
+
+				promise_type *promise{};
+				T *value{};
+
+				iterator(promise_type *promise, T *value) noexcept :
+					promise{ promise },
+					value{ value }
+				{}
+
+				class advance_awaiter : public next_awaiter
+				{
+					iterator &it;
+
+				public:
+					explicit advance_awaiter(iterator &it) noexcept :
+						next_awaiter{ it.promise },
+						it{ it }
+					{}
+
+					iterator &await_resume()
+					{
+						it.value = next_awaiter::await_resume();
+						return it;
+					}
+				};
+
+			public:
+				using value_type = T;
+
+				iterator() noexcept = default;
+
+				T &operator *() const noexcept
+				{
+					return *value;
+				}
+
+				T *operator ->() const noexcept
+				{
+					return value;
+				}
+
+				advance_awaiter operator ++() noexcept
+				{
+					return advance_awaiter{ *this };
+				}
+
+				friend bool operator ==(const iterator &a, const iterator &b) noexcept
+				{
+					return a.value == b.value;
+				}
+
+				friend bool operator !=(const iterator &a, const iterator &b) noexcept
+				{
+					return a.value != b.value;
+				}
+			};
+
+			class begin_awaiter : public next_awaiter
+			{
+			public:
+				using next_awaiter::next_awaiter;
+
+				iterator await_resume()
+				{
+					return iterator{ this->promise, next_awaiter::await_resume() };
+				}
+			};
+
+			begin_awaiter begin() noexcept
+			{
+				return begin_awaiter{ std::addressof(handle.promise()) };
+			}
+
+			static iterator end() noexcept
+			{
+				return {};
+			}
+		};
+
+		// calls f for every value produced by the generator; f may return an awaitable, which is awaited before the next
+		// value is pulled
+		template<class T, class F>
+		inline task<void> for_each(async_generator<T> &generator, F f)
+		{
+			while (auto value = co_await generator.next())
+			{
+				if constexpr (std::is_void_v<std::invoke_result_t<F &, T &>>)
+					f(*value);
+				else
+					co_await f(*value);
+			}
+		}
+
+		// Suspended awaiter of async_event, async_mutex, async_semaphore or async_channel, linked into intrusive lists through
+		// next
+		struct sync_waiter
+		{
+			sync_waiter *next{};
+			continuation resume;
+		};
+
+		// reverses a lock-free stack of waiters into arrival order
+		inline sync_waiter *reverse_waiters(sync_waiter *stack) noexcept
+		{
+			sync_waiter *list = nullptr;
+			while (stack)
+			{
+				auto next = stack->next;
+				stack->next = list;
+				list = stack;
+				stack = next;
+			}
+			return list;
+		}
+
+		// Resumes a list of waiters on the calling thread. Waiters released while another waiter is being resumed on the same
+		// thread are queued and resumed after it suspends, so chains of hand-offs do not grow the native stack.
+		inline void resume_waiters(sync_waiter *list)
+		{
+			struct queue
+			{
+				sync_waiter *head;
+				sync_waiter *tail;
+				bool active;
+			};
+			thread_local queue q{};
+
+			if (!list)
+				return;
+			if (q.tail)
+				q.tail->next = list;
+			else
+				q.head = list;
+			while (list->next)
+				list = list->next;
+			q.tail = list;
+
+			if (q.active)
+				return;
+			q.active = true;
+			while (auto w = q.head)
+			{
+				q.head = w->next;
+				if (!q.head)
+					q.tail = nullptr;
+				// the waiter lives in the coroutine frame and may be gone after resumption
+				const auto resume = w->resume;
+				resume();
+			}
+			q.active = false;
+		}
+
+		// Bounded multi-producer multi-consumer channel
+		// Values are kept in a lock-free ring of sequence-numbered cells, with the producer and consumer positions on separate
+		// cache lines. send and receive suspend only when the channel is full or empty. Suspended senders and receivers are
+		// linked into intrusive lists through their awaiters and are resumed through resume_waiters by the operation that makes
+		// progress for them, without a kernel transition. The lists are only touched by a short spin lock when somebody waits.
+		// After close(), send fails and receive drains the remaining values, then produces an empty optional.
+		template<class T>
+		class async_channel
+		{
+			// a value that has left the ring must reach its receiver, a failed move would lose it with the lock held
+			static_assert(std::is_nothrow_move_constructible_v<T>, "async_channel<T> requires a nothrow move constructor");
+
+			static constexpr size_t cache_line = 64;
+
+			struct cell
+			{
+				std::atomic<size_t> sequence;
+				alignas(T) unsigned char storage[sizeof(T)];
+
+				T &value() noexcept
+				{
+					return *std::launder(reinterpret_cast<T *>(storage));
+				}
+			};
+
+			enum class wait_status : unsigned char
+			{
+				waiting,
+				done,
+				closed,
+				canceled,
+			};
+
+			struct waiter
+			{
+				waiter *prev{};
+				waiter *next{};
+				// links the waiter into the resumption queue once it has been released
+				sync_waiter wake;
+				wait_status status{ wait_status::waiting };
+				bool queued{ false };
+			};
+
+			// positions are separated by padding rather than alignas, so that a channel may live in a coroutine frame,
+			// which is not over-aligned
+			std::unique_ptr<cell[]> cells;
+			size_t mask;
+			std::byte padding0[cache_line];
+			std::atomic<size_t> enqueue_pos{ 0 };
+			std::byte padding1[cache_line];
+			std::atomic<size_t> dequeue_pos{ 0 };
+			std::byte padding2[cache_line];
+			spinlock lock;
+			std::atomic<size_t> waiting_senders{ 0 };
+			std::atomic<size_t> waiting_receivers{ 0 };
+			std::atomic<bool> closed{ false };
+			waiter_list<waiter> senders;
+			waiter_list<waiter> receivers;
+
+			static size_t round_capacity(size_t capacity) noexcept
+			{
+				size_t result = 2;
+				while (result < capacity)
+					result <<= 1;
+				return result;
+			}
+
+			bool push(T &&value) noexcept
+			{
+				auto pos = enqueue_pos.load(std::memory_order_relaxed);
+				for (;;)
+				{
+					auto &c = cells[pos & mask];
+					const auto seq = c.sequence.load(std::memory_order_acquire);
+					const auto diff = static_cast<std::ptrdiff_t>(seq - pos);
+					if (diff == 0)
+					{
+						if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+						{
+							::new (static_cast<void *>(c.storage)) T(std::move(value));
+							c.sequence.store(pos + 1, std::memory_order_release);
+							return true;
+						}
+					}
+					else if (diff < 0)
+						return false;
+					else
+						pos = enqueue_pos.load(std::memory_order_relaxed);
+				}
+			}
+
+			bool pop(std::optional<T> &out) noexcept
+			{
+				auto pos = dequeue_pos.load(std::memory_order_relaxed);
+				for (;;)
+				{
+					auto &c = cells[pos & mask];
+					const auto seq = c.sequence.load(std::memory_order_acquire);
+					const auto diff = static_cast<std::ptrdiff_t>(seq - (pos + 1));
+					if (diff == 0)
+					{
+						if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+						{
+							out.emplace(std::move(c.value()));
+							c.value().~T();
+							c.sequence.store(pos + mask + 1, std::memory_order_release);
+							return true;
+						}
+					}
+					else if (diff < 0)
+						return false;
+					else
+						pos = dequeue_pos.load(std::memory_order_relaxed);
+				}
+			}
+
+			// hands values to suspended receivers and moves the values of suspended senders into freed cells for as long as
+			// either side makes progress, then resumes the released waiters in arrival order
+			void transfer()
+			{
+				sync_waiter *ready = nullptr;
+				auto tail = &ready;
+				const auto release = [&](waiter *w, std::atomic<size_t> &counter, waiter_list<waiter> &list) noexcept
+				{
+					list.remove(w);
+					w->queued = false;
+					w->status = wait_status::done;
+					counter.fetch_sub(1, std::memory_order_relaxed);
+					w->wake.next = nullptr;
+					*tail = &w->wake;
+					tail = &w->wake.next;
+				};
+
+				lock.lock();
+				for (bool progress = true; progress;)
+				{
+					progress = false;
+					if (auto w = static_cast<receive_awaiter *>(receivers.front()); w && pop(w->value))
+					{
+						release(w, waiting_receivers, receivers);
+						progress = true;
+					}
+					if (auto w = static_cast<send_awaiter *>(senders.front()); w && push(std::move(w->value)))
+					{
+						release(w, waiting_senders, senders);
+						progress = true;
+					}
+				}
+				lock.unlock();
+
+				resume_waiters(ready);
+			}
+
+			// a value has been pushed: hand it to the first suspended receiver, if any
+			void wake_receiver()
+			{
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if (waiting_receivers.load(std::memory_order_relaxed))
+					transfer();
+			}
+
+			// a cell has been freed: move the value of the first suspended sender into it, if any
+			void wake_sender()
+			{
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if (waiting_senders.load(std::memory_order_relaxed))
+					transfer();
+			}
+
+			void cancel_waiter(waiter &w, std::atomic<size_t> &counter, waiter_list<waiter> &list) noexcept
+			{
+				lock.lock();
+				if (!w.queued)
+				{
+					lock.unlock();
+					return;
+				}
+				list.remove(&w);
+				w.queued = false;
+				w.status = wait_status::canceled;
+				counter.fetch_sub(1, std::memory_order_relaxed);
+				lock.unlock();
+				w.wake.next = nullptr;
+				resume_waiters(&w.wake);
+			}
+
+			// T is stored in the awaiter until it has been moved into the channel
+			class send_awaiter : public waiter
+			{
+				friend class async_channel;
+
+				async_channel *channel;
+				T value;
+
+			public:
+				template<class U>
+				send_awaiter(async_channel *channel, U &&value) :
+					channel{ channel },
+					value{ std::forward<U>(value) }
+				{}
+
+				send_awaiter(send_awaiter &&o) :
+					channel{ o.channel },
+					value{ std::move(o.value) }
+				{}
+
+				bool await_ready()
+				{
+					if (channel->closed.load(std::memory_order_acquire))
+					{
+						this->status = wait_status::closed;
+						return true;
+					}
+					if (!channel->push(std::move(value)))
+						return false;
+					this->status = wait_status::done;
+					channel->wake_receiver();
+					return true;
+				}
+
+				bool await_suspend(continuation resume_handle)
+				{
+					this->wake.resume = resume_handle;
+					auto &c = *channel;
+					c.lock.lock();
+					if (c.closed.load(std::memory_order_relaxed))
+					{
+						c.lock.unlock();
+						this->status = wait_status::closed;
+						return false;
+					}
+					c.waiting_senders.fetch_add(1, std::memory_order_relaxed);
+					std::atomic_thread_fence(std::memory_order_seq_cst);
+					if (c.push(std::move(value)))
+					{
+						c.waiting_senders.fetch_sub(1, std::memory_order_relaxed);
+						c.lock.unlock();
+						this->status = wait_status::done;
+						c.wake_receiver();
+						return false;
+					}
+					c.senders.push_back(this);
+					this->queued = true;
+					c.lock.unlock();
+					return true;
+				}
+
+				bool await_suspend(coro::coroutine_handle<> resume_handle)
+				{
+					return await_suspend(continuation{ resume_handle });
+				}
+
+				// true if the value has been sent, false if the channel has been closed
+				expected<bool> try_resume() noexcept
+				{
+					if (this->status == wait_status::canceled)
+						return canceled_error();
+					return this->status == wait_status::done;
+				}
+
+				bool await_resume()
+				{
+					if (this->status == wait_status::canceled)
+						throw_canceled();
+					return this->status == wait_status::done;
+				}
+
+				// withdraws a suspended send, which then reports cancellation
+				void cancel() noexcept
+				{
+					channel->cancel_waiter(*this, channel->waiting_senders, channel->senders);
+				}
+			};
+
+			class receive_awaiter : public waiter
+			{
+				friend class async_channel;
+
+			protected:
+				async_channel *channel;
+				std::optional<T> value;
+
+			public:
+				explicit receive_awaiter(async_channel *channel) noexcept :
+					channel{ channel }
+				{}
+
+				receive_awaiter(receive_awaiter &&o) noexcept :
+					channel{ o.channel }
+				{}
+
+				bool await_ready()
+				{
+					if (channel->pop(value))
+					{
+						channel->wake_sender();
+						return true;
+					}
+					return false;
+				}
+
+				bool await_suspend(continuation resume_handle)
+				{
+					this->wake.resume = resume_handle;
+					auto &c = *channel;
+					c.lock.lock();
+					c.waiting_receivers.fetch_add(1, std::memory_order_relaxed);
+					std::atomic_thread_fence(std::memory_order_seq_cst);
+					if (c.pop(value) || c.closed.load(std::memory_order_relaxed))
+					{
+						c.waiting_receivers.fetch_sub(1, std::memory_order_relaxed);
+						c.lock.unlock();
+						if (value)
+							c.wake_sender();
+						return false;
+					}
+					c.receivers.push_back(this);
+					this->queued = true;
+					c.lock.unlock();
+					return true;
+				}
+
+				bool await_suspend(coro::coroutine_handle<> resume_handle)
+				{
+					return await_suspend(continuation{ resume_handle });
+				}
+
+				// empty once the channel has been closed and drained
+				expected<std::optional<T>> try_resume() noexcept
+				{
+					if (this->status == wait_status::canceled)
+						return canceled_error();
+					return std::move(value);
+				}
+
+				std::optional<T> await_resume()
+				{
+					if (this->status == wait_status::canceled)
+						throw_canceled();
+					return std::move(value);
+				}
+
+				void cancel() noexcept
+				{
+					channel->cancel_waiter(*this, channel->waiting_receivers, channel->receivers);
+				}
+			};
+
+			// receives at least one value, then whatever is available up to the limit
+			class receive_many_awaiter : public receive_awaiter
+			{
+				std::vector<T> *out;
+				size_t limit;
+
+			public:
+				receive_many_awaiter(async_channel *channel, std::vector<T> &out, size_t limit) noexcept :
+					receive_awaiter{ channel },
+					out{ &out },
+					limit{ limit }
+				{}
+
+				// number of values appended to the vector, 0 once the channel has been closed and drained
+				size_t await_resume()
+				{
+					auto first = receive_awaiter::await_resume();
+					if (!first)
+						return 0;
+					out->push_back(std::move(*first));
+					size_t count = 1;
+					for (std::optional<T> v; count < limit && this->channel->pop(v); ++count)
+					{
+						out->push_back(std::move(*v));
+						this->channel->wake_sender();
+					}
+					return count;
+				}
+			};
+
+		public:
+			// capacity is rounded up to a power of two
+			explicit async_channel(size_t capacity) :
+				cells{ std::make_unique<cell[]>(round_capacity(capacity)) },
+				mask{ round_capacity(capacity) - 1 }
+			{
+				for (size_t i = 0; i <= mask; ++i)
+					cells[i].sequence.store(i, std::memory_order_relaxed);
+			}
+
+			async_channel(const async_channel &) = delete;
+			async_channel &operator =(const async_channel &) = delete;
+
+			// there must be no suspended senders or receivers
+			~async_channel()
+			{
+				for (std::optional<T> v; pop(v); v.reset())
+				{
+				}
+			}
+
+			size_t capacity() const noexcept
+			{
+				return mask + 1;
+			}
+
+			// awaitable that produces true once the value is in the channel, or false if the channel is closed
+			template<class U>
+			send_awaiter send(U &&value)
+			{
+				return send_awaiter{ this, std::forward<U>(value) };
+			}
+
+			// awaitable that produces the next value, or an empty optional once the channel is closed and drained
+			receive_awaiter receive() noexcept
+			{
+				return receive_awaiter{ this };
+			}
+
+			// awaitable that appends at least one and at most limit values to out and produces their number
+			receive_many_awaiter receive_many(std::vector<T> &out, size_t limit)
+			{
+				assert(limit);
+				return receive_many_awaiter{ this, out, limit };
+			}
+
+			// fails if the channel is full or closed; the value is not moved from on failure
+			bool try_send(T &&value)
+			{
+				if (closed.load(std::memory_order_acquire) || !push(std::move(value)))
+					return false;
+				wake_receiver();
+				return true;
+			}
+
+			// sends a copy, or a value converted from another type
+			template<class U>
+			bool try_send(U &&value)
+			{
+				return try_send(T(std::forward<U>(value)));
+			}
+
+			std::optional<T> try_receive()
+			{
+				std::optional<T> result;
+				if (pop(result))
+					wake_sender();
+				return result;
+			}
+
+			// fails suspended and future sends, lets receivers drain the remaining values
+			void close()
+			{
+				closed.store(true, std::memory_order_seq_cst);
+
+				lock.lock();
+				auto sender_list = senders.take_all();
+				auto receiver_list = receivers.take_all();
+				waiting_senders.store(0, std::memory_order_relaxed);
+				waiting_receivers.store(0, std::memory_order_relaxed);
+				for (auto w = receiver_list; w; w = w->next)
+				{
+					w->queued = false;
+					w->status = pop(static_cast<receive_awaiter *>(w)->value) ? wait_status::done : wait_status::closed;
+				}
+				for (auto w = sender_list; w; w = w->next)
+				{
+					w->queued = false;
+					w->status = wait_status::closed;
+				}
+				lock.unlock();
+
+				// receivers first, then senders, each in arrival order
+				sync_waiter *ready = nullptr;
+				auto tail = &ready;
+				for (auto list : { receiver_list, sender_list })
+				{
+					for (auto w = list; w; w = w->next)
+					{
+						w->wake.next = nullptr;
+						*tail = &w->wake;
+						tail = &w->wake.next;
+					}
+				}
+				resume_waiters(ready);
+			}
+
+			bool is_closed() const noexcept
+			{
+				return closed.load(std::memory_order_acquire);
+			}
+		};
+
+		// Manual-reset event
+		// The state word holds this object's address when the event is set, or the top of a lock-free stack of waiters
+		// stored in the awaiters. Awaiting a set event is a single atomic load.
+		class async_event
+		{
+			mutable std::atomic<void *> state;
+
+			void *set_state() const noexcept
+			{
+				return const_cast<async_event *>(this);
+			}
+
+			class awaiter : public sync_waiter
+			{
+				const async_event *event;
+
+			public:
+				explicit awaiter(const async_event &event) noexcept :
+					event{ &event }
+				{}
+
+				bool await_ready() const noexcept
+				{
+					return event->is_set();
+				}
+
+				bool await_suspend(continuation resume_handle) noexcept
+				{
+					resume = resume_handle;
+					auto &state = event->state;
+					auto old = state.load(std::memory_order_acquire);
+					do
+					{
+						if (old == event->set_state())
+							return false;
+						next = static_cast<sync_waiter *>(old);
+					} while (!state.compare_exchange_weak(old, static_cast<sync_waiter *>(this), std::memory_order_release, std::memory_order_acquire));
+					return true;
+				}
+
+				bool await_suspend(coro::coroutine_handle<> resume_handle) noexcept
+				{
+					return await_suspend(continuation{ resume_handle });
+				}
+
+				static void await_resume() noexcept
+				{
+				}
+			};
+
+		public:
+			explicit async_event(bool initially_set = false) noexcept :
+				state{ initially_set ? set_state() : nullptr }
+			{}
+
+			async_event(const async_event &) = delete;
+			async_event &operator =(const async_event &) = delete;
+
+			bool is_set() const noexcept
+			{
+				return state.load(std::memory_order_acquire) == set_state();
+			}
+
+			// sets the event and resumes all waiters in the order they started waiting
+			void set()
+			{
+				auto old = state.exchange(set_state(), std::memory_order_acq_rel);
+				if (old != set_state())
+					resume_waiters(reverse_waiters(static_cast<sync_waiter *>(old)));
+			}
+
+			void reset() noexcept
+			{
+				auto old = set_state();
+				state.compare_exchange_strong(old, nullptr, std::memory_order_relaxed);
+			}
+
+			awaiter operator co_await() const noexcept
+			{
+				return awaiter{ *this };
+			}
+		};
+
+		class async_mutex;
+
+		// Owns a locked async_mutex and unlocks it on destruction
+		class async_mutex_lock
+		{
+			async_mutex *mutex{};
+
+		public:
+			async_mutex_lock() noexcept = default;
+
+			explicit async_mutex_lock(async_mutex &mutex, std::adopt_lock_t) noexcept :
+				mutex{ &mutex }
+			{}
+
+			async_mutex_lock(async_mutex_lock &&o) noexcept :
+				mutex{ std::exchange(o.mutex, nullptr) }
+			{}
+
+			async_mutex_lock &operator =(async_mutex_lock &&o) noexcept
+			{
+				if (this != &o)
+				{
+					unlock();
+					mutex = std::exchange(o.mutex, nullptr);
+				}
+				return *this;
+			}
+
+			~async_mutex_lock()
+			{
+				unlock();
+			}
+
+			bool owns_lock() const noexcept
+			{
+				return mutex != nullptr;
+			}
+
+			explicit operator bool() const noexcept
+			{
+				return owns_lock();
+			}
+
+			inline void unlock();
+		};
+
+		// Mutex for coroutines
+		// The state word is not_locked, locked_no_waiters or the top of a lock-free stack of newly arrived waiters. The owner
+		// moves them into a FIFO list on unlock and hands the lock to the first one, so lock and an uncontended unlock are a
+		// single compare-and-swap each.
+		class async_mutex
+		{
+			static constexpr uintptr_t not_locked = 1;
+			static constexpr uintptr_t locked_no_waiters = 0;
+
+			std::atomic<uintptr_t> state{ not_locked };
+			// waiters in arrival order, only accessed by the owner
+			sync_waiter *waiters{};
+
+			class lock_awaiter : public sync_waiter
+			{
+			protected:
+				async_mutex *mutex;
+
+			public:
+				explicit lock_awaiter(async_mutex &mutex) noexcept :
+					mutex{ &mutex }
+				{}
+
+				bool await_ready() noexcept
+				{
+					return mutex->try_lock();
+				}
+
+				bool await_suspend(continuation resume_handle) noexcept
+				{
+					resume = resume_handle;
+					auto old = mutex->state.load(std::memory_order_acquire);
+					for (;;)
+					{
+						if (old == not_locked)
+						{
+							if (mutex->state.compare_exchange_weak(old, locked_no_waiters, std::memory_order_acquire, std::memory_order_acquire))
+								return false;
+						}
+						else
+						{
+							next = reinterpret_cast<sync_waiter *>(old);
+							if (mutex->state.compare_exchange_weak(old, reinterpret_cast<uintptr_t>(static_cast<sync_waiter *>(this)), std::memory_order_release, std::memory_order_acquire))
+								return true;
+						}
+					}
+				}
+
+				bool await_suspend(coro::coroutine_handle<> resume_handle) noexcept
+				{
+					return await_suspend(continuation{ resume_handle });
+				}
+
+				static void await_resume() noexcept
+				{
+				}
+			};
+
+			class scoped_lock_awaiter : public lock_awaiter
+			{
+			public:
+				using lock_awaiter::lock_awaiter;
+
+				async_mutex_lock await_resume() noexcept
+				{
+					return async_mutex_lock{ *this->mutex, std::adopt_lock };
+				}
+			};
+
+		public:
+			async_mutex() noexcept = default;
+			async_mutex(const async_mutex &) = delete;
+			async_mutex &operator =(const async_mutex &) = delete;
+
+			bool try_lock() noexcept
+			{
+				auto old = not_locked;
+				return state.compare_exchange_strong(old, locked_no_waiters, std::memory_order_acquire, std::memory_order_relaxed);
+			}
+
+			// co_await lock() acquires the mutex, which must then be released with unlock()
+			lock_awaiter lock() noexcept
+			{
+				return lock_awaiter{ *this };
+			}
+
+			// co_await scoped_lock() produces an async_mutex_lock that releases the mutex when destroyed
+			scoped_lock_awaiter scoped_lock() noexcept
+			{
+				return scoped_lock_awaiter{ *this };
+			}
+
+			// hands the mutex over to the first waiter, if any, and resumes it
+			void unlock()
+			{
+				assert(state.load(std::memory_order_relaxed) != not_locked);
+				auto w = waiters;
+				if (!w)
+				{
+					auto old = locked_no_waiters;
+					if (state.compare_exchange_strong(old, not_locked, std::memory_order_release, std::memory_order_relaxed))
+						return;
+
+					// collect the waiters that arrived since the last unlock
+					old = state.exchange(locked_no_waiters, std::memory_order_acquire);
+					w = reverse_waiters(reinterpret_cast<sync_waiter *>(old));
+				}
+				waiters = w->next;
+				w->next = nullptr;
+				resume_waiters(w);
+			}
+		};
+
+		inline void async_mutex_lock::unlock()
+		{
+			if (mutex)
+				std::exchange(mutex, nullptr)->unlock();
+		}
+
+		// Counting semaphore for coroutines
+		// acquire is a single atomic decrement while permits are available. Otherwise the awaiter pushes itself onto a
+		// lock-free stack, and permits released to waiters are matched with them by whichever thread finds the
+		// dispatcher idle; other threads only leave their work to it, so nobody waits for a lock.
+		class async_semaphore
+		{
+			// permits minus committed waiters
+			std::atomic<ptrdiff_t> count;
+			std::atomic<sync_waiter *> incoming{ nullptr };
+			std::atomic<size_t> grants{ 0 };
+			std::atomic<size_t> dispatch_requests{ 0 };
+			// owned by the dispatcher
+			sync_waiter *queue_head{};
+			sync_waiter *queue_tail{};
+			size_t available{ 0 };
+
+			// returns true if self has been granted a permit and is not resumed
+			bool dispatch(const sync_waiter *self)
+			{
+				if (dispatch_requests.fetch_add(1, std::memory_order_acq_rel))
+					return false;
+
+				bool self_granted = false;
+				sync_waiter *ready_head = nullptr;
+				sync_waiter *ready_tail = nullptr;
+				size_t pending = 1;
+				do
+				{
+					if (auto arrived = reverse_waiters(incoming.exchange(nullptr, std::memory_order_acquire)))
+					{
+						if (queue_tail)
+							queue_tail->next = arrived;
+						else
+							queue_head = arrived;
+						for (queue_tail = arrived; queue_tail->next; queue_tail = queue_tail->next)
+						{
+						}
+					}
+					available += grants.exchange(0, std::memory_order_acquire);
+
+					while (available && queue_head)
+					{
+						auto w = queue_head;
+						queue_head = w->next;
+						if (!queue_head)
+							queue_tail = nullptr;
+						w->next = nullptr;
+						--available;
+
+						if (w == self)
+							self_granted = true;
+						else
+						{
+							if (ready_tail)
+								ready_tail->next = w;
+							else
+								ready_head = w;
+							ready_tail = w;
+						}
+					}
+					pending = dispatch_requests.fetch_sub(pending, std::memory_order_acq_rel) - pending;
+				} while (pending);
+
+				resume_waiters(ready_head);
+				return self_granted;
+			}
+
+			class awaiter : public sync_waiter
+			{
+				async_semaphore *semaphore;
+
+			public:
+				explicit awaiter(async_semaphore &semaphore) noexcept :
+					semaphore{ &semaphore }
+				{}
+
+				bool await_ready() noexcept
+				{
+					return semaphore->count.fetch_sub(1, std::memory_order_acquire) > 0;
+				}
+
+				// the permit has been claimed by await_ready and is handed over by release
+				bool await_suspend(continuation resume_handle)
+				{
+					resume = resume_handle;
+					auto &incoming = semaphore->incoming;
+					auto old = incoming.load(std::memory_order_relaxed);
+					do
+					{
+						next = old;
+					} while (!incoming.compare_exchange_weak(old, this, std::memory_order_release, std::memory_order_relaxed));
+					return !semaphore->dispatch(this);
+				}
+
+				bool await_suspend(coro::coroutine_handle<> resume_handle)
+				{
+					return await_suspend(continuation{ resume_handle });
+				}
+
+				static void await_resume() noexcept
+				{
+				}
+			};
+
+		public:
+			explicit async_semaphore(ptrdiff_t permits) noexcept :
+				count{ permits }
+			{}
+
+			async_semaphore(const async_semaphore &) = delete;
+			async_semaphore &operator =(const async_semaphore &) = delete;
+
+			bool try_acquire() noexcept
+			{
+				auto old = count.load(std::memory_order_relaxed);
+				while (old > 0)
+				{
+					if (count.compare_exchange_weak(old, old - 1, std::memory_order_acquire, std::memory_order_relaxed))
+						return true;
+				}
+				return false;
+			}
+
+			// co_await acquire() takes a permit, which must be returned with release()
+			awaiter acquire() noexcept
+			{
+				return awaiter{ *this };
+			}
+
+			// returns permits and resumes as many waiters
+			void release(ptrdiff_t permits = 1)
+			{
+				const auto old = count.fetch_add(permits, std::memory_order_release);
+				if (old >= 0)
+					return;
+				grants.fetch_add(static_cast<size_t>((std::min)(permits, -old)), std::memory_order_release);
+				dispatch(nullptr);
+			}
+		};
+
+		// no_result will substitute 'void' in tuple
+		struct no_result {};
+
+		// get_result_type 
+		// get the coroutine result type
+		// supports IAsyncAction, IAsyncOperation<T> and awaitable object that implements await_resume
+		// yields result_type<T> where T is a coroutine result type
+		template<class T>
+		struct result_type
+		{
+			using type = T;
+		};
+
+#if defined(_WIN32)
+		constexpr result_type<void> get_result_type(const ::winrt::Windows::Foundation::IAsyncAction &)
+		{
+			return {};
+		}
+
+		template<class T>
+		constexpr result_type<T> get_result_type(const ::winrt::Windows::Foundation::IAsyncOperation<T> &)
+		{
+			return {};
+		}
+#endif
+
+		// primary template handles types that do not implement await_resume:
+		template<class, class = std::void_t<>>
+		struct has_await_resume : std::false_type {};
+
+		// specialization recognizes types that do implement await_resume
+		template<class T>
+		struct has_await_resume<T, std::void_t<decltype(std::declval<T&>().await_resume())>> : std::true_type {};
+
+		template<class T>
+		constexpr bool has_await_resume_v = has_await_resume<T>::value;
+
+		// "external" cae
+		template<class, class = std::void_t<>>
+		struct has_external_await_resume : std::false_type {};
+
+		template<class T>
+		struct has_external_await_resume<T, std::void_t<decltype(await_resume(std::declval<T &>()))>> : std::true_type {};
+
+		template<class T>
+		constexpr bool has_external_await_resume_v = has_external_await_resume<T>::value;
+
+		// types that produce their awaiter with member operator co_await
+		template<class, class = std::void_t<>>
+		struct has_member_co_await : std::false_type {};
+
+		template<class T>
+		struct has_member_co_await<T, std::void_t<decltype(std::declval<T &>().operator co_await())>> : std::true_type {};
+
+		template<class T>
+		constexpr bool has_member_co_await_v = has_member_co_await<T>::value;
+
+		//
+		template<class T>
+		constexpr result_type<std::decay_t<decltype(std::declval<T &>().await_resume())>> get_result_type(const T &, std::enable_if_t<has_await_resume_v<T>, void *> = nullptr)
+		{
+			return {};
+		}
+
+		template<class T>
+		constexpr result_type<std::decay_t<decltype(await_resume(std::declval<T &>()))>> get_result_type(const T &, std::enable_if_t<has_external_await_resume_v<T>, void *> = nullptr)
+		{
+			return {};
+		}
+
+		template<class T>
+		constexpr result_type<std::decay_t<decltype(std::declval<T &>().operator co_await().await_resume())>> get_result_type(const T &, std::enable_if_t<has_member_co_await_v<T> && !has_await_resume_v<T>, void *> = nullptr)
+		{
+			return {};
+		}
+
+		// Helper to get a coroutine result type for a first item in variadic sequence
+		template<class First, class...Rest>
+		constexpr auto get_first_result_type(const First &first, const Rest &...)
+		{
+			return get_result_type(first);
+		}
+
+		// Get a first type in a variadic type list
+		template<class...T>
+		struct get_first;
+
+		template<class F,class...R>
+		struct get_first<F, R...>
+		{
+			using type = F;
+		};
+
+		template<class...T>
+		using get_first_t = typename get_first<T...>::type;
+
+		template<class...Ts>
+		struct are_all_same
+		{
+			using first_type = get_first_t<Ts...>;
+
+			using type = std::conjunction<std::is_same<first_type, Ts>...>;
+		};
+
+		template<class...Ts>
+		using are_all_same_t = typename are_all_same<Ts...>::type;
+
+		template<class...Ts>
+		constexpr bool are_all_same_v = are_all_same<Ts...>::type::value;
+
+		// get_awaiter
+		// obtain the awaiter for an awaitable: result of member or free operator co_await or the object itself
+		template<class T>
+		inline auto get_awaiter_impl(T &&value, int) -> decltype(std::forward<T>(value).operator co_await())
+		{
+			return std::forward<T>(value).operator co_await();
+		}
+
+		template<class T>
+		inline auto get_awaiter_impl(T &&value, long) -> decltype(operator co_await(std::forward<T>(value)))
+		{
+			return operator co_await(std::forward<T>(value));
+		}
+
+		template<class T>
+		inline T &&get_awaiter_impl(T &&value, ...)
+		{
+			return std::forward<T>(value);
+		}
+
+		template<class T>
+		inline decltype(auto) get_awaiter(T &&value)
+		{
+			return get_awaiter_impl(std::forward<T>(value), 0);
+		}
+
+		// is_range
+		template<class, class = std::void_t<>>
+		struct is_range : std::false_type {};
+
+		template<class T>
+		struct is_range<T, std::void_t<decltype(std::begin(std::declval<T &>()) != std::end(std::declval<T &>()))>> : std::true_type {};
+
+		template<class T>
+		constexpr bool is_range_v = is_range<T>::value;
+
+		// Drives one child of a combinator by calling await_ready/await_suspend/await_resume of its awaiter directly.
+		// Awaiters that accept continuation report completion straight to the combinator, others are awaited by a helper
+		// coroutine whose frame comes from the frame allocator. Child results stay in the awaiter until get() is called.
+		// Master::finished(node) is called once the child completes and returns a coroutine to resume or null. While Master
+		// is starting its children it must return null.
+		template<class Master, class Child>
+		class awaiter_node
+		{
+			using awaiter_t = decltype(get_awaiter(std::declval<Child &>()));
+			static constexpr bool stores_awaiter = !std::is_reference_v<awaiter_t>;
+
+			// constructs the awaiter in place, so it does not have to be movable
+			struct make_awaiter
+			{
+				Child *child;
+
+				operator awaiter_t() const
+				{
+					return get_awaiter(*child);
+				}
+			};
+
+			Master *master{ nullptr };
+			Child *child{ nullptr };
+			std::conditional_t<stores_awaiter, std::optional<awaiter_t>, no_result> awaiter_storage;
+			std::exception_ptr exception;
+
+			decltype(auto) awaiter() noexcept
+			{
+				if constexpr (stores_awaiter)
+					return *awaiter_storage;
+				else
+					return get_awaiter(*child);
+			}
+
+			static coro::coroutine_handle<> on_completed(void *context) noexcept
+			{
+				auto node = static_cast<awaiter_node *>(context);
+				return node->master->finished(node);
+			}
+
+			struct proxy
+			{
+				awaiter_node *node;
+
+				static bool await_ready() noexcept
+				{
+					return false;
+				}
+
+				decltype(auto) await_suspend(coro::coroutine_handle<> handle)
+				{
+					return node->awaiter().await_suspend(handle);
+				}
+
+				static void await_resume() noexcept
+				{
+				}
+			};
+
+			static detached_handoff helper(awaiter_node *node) noexcept
+			{
+				try
+				{
+					co_await proxy{ node };
+				}
+				catch (...)
+				{
+					node->exception = std::current_exception();
+				}
+				co_return node->master->finished(node);
+			}
+
+		public:
+			awaiter_node() noexcept = default;
+
+			// nodes are only moved together with their combinator, before any child is started
+			awaiter_node(awaiter_node &&) noexcept
+			{}
+
+			void start(Master *master_, Child &child_) noexcept
+			{
+				master = master_;
+				child = &child_;
+				try
+				{
+					if constexpr (stores_awaiter)
+						awaiter_storage.emplace(make_awaiter{ child });
+
+					auto &&a = awaiter();
+					using a_t = std::remove_reference_t<decltype(a)>;
+					if (a.await_ready())
+						master->finished(this);
+					else if constexpr (accepts_continuation_v<a_t>)
+					{
+						if constexpr (std::is_void_v<decltype(a.await_suspend(std::declval<continuation>()))>)
+							a.await_suspend(continuation{ &on_completed, this });
+						else if (!a.await_suspend(continuation{ &on_completed, this }))
+							master->finished(this);
+					}
+					else
+						helper(this);
+				}
+				catch (...)
+				{
+					exception = std::current_exception();
+					master->finished(this);
+				}
+			}
+
+			// result of the completed child
+			decltype(auto) get()
+			{
+				if (exception)
+					std::rethrow_exception(exception);
+				return awaiter().await_resume();
+			}
+		};
+
+		// cancels an awaitable if it supports cancellation
+		template<class Awaitable>
+		inline void cancel_awaitable(Awaitable &awaitable) noexcept
+		{
+			if constexpr (is_cancellable_v<Awaitable>)
+			{
+				try
+				{
+					awaitable.cancel();
+				}
+				catch (...)
+				{
+				}
+			}
+		}
+
+		// try_await
+		// co_await try_await(awaitable) produces expected<T> instead of throwing. Awaiters of this library that implement
+		// try_resume report cancellation, timeouts and I/O errors without an exception. For other awaitables, std::system_error
+		// (and hresult_error on Windows) is caught and converted.
+		template<class, class = std::void_t<>>
+		struct has_try_resume : std::false_type {};
+
+		template<class T>
+		struct has_try_resume<T, std::void_t<decltype(std::declval<T &>().try_resume())>> : std::true_type {};
+
+		template<class T>
+		constexpr bool has_try_resume_v = has_try_resume<T>::value;
+
+#if defined(_WIN32)
+		inline std::error_code error_from_hresult(winrt::hresult code) noexcept
+		{
+			if (code == HRESULT_FROM_WIN32(ERROR_CANCELLED))
+				return canceled_error();
+			if (HRESULT_FACILITY(code) == FACILITY_WIN32)
+				return std::error_code(HRESULT_CODE(code), std::system_category());
+			return std::error_code(static_cast<int32_t>(code), std::system_category());
+		}
+#endif
+
+		template<class Awaitable>
+		class try_awaitable
+		{
+			using awaiter_t = decltype(get_awaiter(std::declval<Awaitable &>()));
+			static constexpr bool stores_awaiter = !std::is_reference_v<awaiter_t>;
+			using awaiter_ref_t = std::remove_reference_t<awaiter_t>;
+			using value_t = std::decay_t<decltype(std::declval<awaiter_ref_t &>().await_resume())>;
+
+			Awaitable awaitable;
+			std::conditional_t<stores_awaiter, std::optional<awaiter_t>, no_result> awaiter_storage;
+
+			decltype(auto) awaiter()
+			{
+				if constexpr (stores_awaiter)
+				{
+					if (!awaiter_storage)
+						awaiter_storage.emplace(get_awaiter(awaitable));
+					return *awaiter_storage;
+				}
+				else
+					return get_awaiter(awaitable);
+			}
+
+		public:
+			try_awaitable(Awaitable &&awaitable) :
+				awaitable{ std::forward<Awaitable>(awaitable) }
+			{}
+
+			bool await_ready()
+			{
+				return awaiter().await_ready();
+			}
+
+			// accepts whatever the wrapped awaiter accepts: a coroutine handle or also a continuation
+			template<class Handle>
+			auto await_suspend(Handle handle) -> decltype(std::declval<awaiter_ref_t &>().await_suspend(handle))
+			{
+				return awaiter().await_suspend(handle);
+			}
+
+			auto await_resume()
+			{
+				if constexpr (has_try_resume_v<awaiter_ref_t>)
+					return awaiter().try_resume();
+				else
+				{
+					try
+					{
+						if constexpr (std::is_void_v<value_t>)
+						{
+							awaiter().await_resume();
+							return expected<void>{};
+						}
+						else
+							return expected<value_t>{ awaiter().await_resume() };
+					}
+					catch (const std::system_error &e)
+					{
+						return expected<value_t>{ e.code() };
+					}
+#if defined(_WIN32)
+					catch (const winrt::hresult_error &e)
+					{
+						return expected<value_t>{ error_from_hresult(e.code()) };
+					}
+#endif
+				}
+			}
+
+			void cancel() noexcept
+			{
+				cancel_awaitable(awaitable);
+			}
+		};
+
+		template<class Awaitable>
+		inline auto try_await(Awaitable &&awaitable)
+		{
+			return try_awaitable<Awaitable>{ std::forward<Awaitable>(awaitable) };
+		}
+
+		template<class Master, class Awaitable>
+		using awaiter_node_result_t = decltype(std::declval<awaiter_node<Master, std::decay_t<Awaitable>> &>().get());
+
+		// when_all
+		// Children are started in a loop; an extra count held by the loop prevents resumption of the awaiting coroutine
+		// until every child has been started.
+		class when_all_base
+		{
+			std::atomic<size_t> counter{ 0 };
+			continuation resume;
+
+		protected:
+			// returns true if the awaiting coroutine has to suspend
+			template<class Start>
+			bool start(continuation handle, size_t count, Start &&start_children) noexcept
+			{
+				trace(trace_event::when_all_started, this, static_cast<uint32_t>(count));
+				resume = handle;
+				counter.store(count + 1, std::memory_order_relaxed);
+				start_children();
+				if (1 != counter.fetch_sub(1, std::memory_order_acq_rel))
+					return true;
+				trace(trace_event::when_all_completed, this);
+				return false;
+			}
+
+		public:
+			when_all_base() noexcept = default;
+
+			// it is safe to "move" this way because the state is not used until the final instance is awaited
+			when_all_base(when_all_base &&) noexcept
+			{}
+
+			template<class Node>
+			coro::coroutine_handle<> finished(Node *) noexcept
+			{
+				if (1 == counter.fetch_sub(1, std::memory_order_acq_rel))
+				{
+					trace(trace_event::when_all_completed, this);
+					return resume.get();
+				}
+				else
+					return nullptr;
+			}
+		};
+
+		template<class...Awaitables>
+		class when_all_awaitable : when_all_base
+		{
+			template<class Awaitable>
+			using result_t = std::conditional_t<
+				std::is_void_v<awaiter_node_result_t<when_all_base, Awaitable>>,
+				no_result,
+				std::decay_t<awaiter_node_result_t<when_all_base, Awaitable>>>;
+
+			static constexpr bool is_void = (std::is_void_v<awaiter_node_result_t<when_all_base, Awaitables>> && ...);
+
+			std::tuple<std::decay_t<Awaitables>...> awaitables;
+			std::tuple<awaiter_node<when_all_base, std::decay_t<Awaitables>>...> nodes;
+
+			template<size_t...I>
+			void start_children(std::index_sequence<I...>) noexcept
+			{
+				(std::get<I>(nodes).start(this, std::get<I>(awaitables)), ...);
+			}
+
+			template<size_t I>
+			auto get_result()
+			{
+				if constexpr (std::is_void_v<decltype(std::get<I>(nodes).get())>)
+				{
+					std::get<I>(nodes).get();
+					return no_result{};
+				}
+				else
+					return std::get<I>(nodes).get();
+			}
+
+			// results are collected in argument order, so the exception of the first failed child is rethrown
+			template<size_t...I>
+			auto get_results(std::index_sequence<I...>)
+			{
+				if constexpr (is_void)
+					(std::get<I>(nodes).get(), ...);
+				else
+					return std::tuple<result_t<Awaitables>...>{ get_result<I>()... };
+			}
+
+		public:
+			when_all_awaitable(Awaitables &&...awaitables) :
+				awaitables{ std::forward<Awaitables>(awaitables)... }
+			{}
+
+			bool await_ready() const noexcept
+			{
+				return false;
+			}
+
+			bool await_suspend(coro::coroutine_handle<> handle) noexcept
+			{
+				return await_suspend(continuation{ handle });
+			}
+
+			bool await_suspend(continuation handle) noexcept
+			{
+				return start(handle, sizeof...(Awaitables), [this]() noexcept
+				{
+					start_children(std::index_sequence_for<Awaitables...>{});
+				});
+			}
+
+			auto await_resume()
+			{
+				return get_results(std::index_sequence_for<Awaitables...>{});
+			}
+
+			// cancels all children that support cancellation
+			void cancel() noexcept
+			{
+				std::apply([](auto &...children) noexcept
+				{
+					(cancel_awaitable(children), ...);
+				}, awaitables);
+			}
+		};
+
+		template<class...Awaitables>
+		inline auto when_all(Awaitables &&...awaitables)
+		{
+			static_assert(sizeof...(Awaitables) >= 2, "when_all must be passed at least two arguments");
+
+			return when_all_awaitable<Awaitables...>{ std::forward<Awaitables>(awaitables)... };
+		}
+
+		// when_all over a range
+		// The counter, the awaiting coroutine and the nodes of all children are kept in a single block allocated when the
+		// awaiting coroutine suspends. Results stay in the nodes until they are moved into the result vector.
+		template<class Range>
+		class when_all_range_awaitable
+		{
+			using child_t = std::remove_reference_t<decltype(*std::begin(std::declval<Range &>()))>;
+
+			class block : public when_all_base
+			{
+			public:
+				using node_t = awaiter_node<block, child_t>;
+
+			private:
+				static_assert(alignof(node_t) <= alignof(std::max_align_t), "over-aligned awaitables are not supported");
+
+				size_t count;
+
+				static constexpr size_t nodes_offset() noexcept
+				{
+					return (sizeof(block) + alignof(node_t) - 1) / alignof(node_t) * alignof(node_t);
+				}
+
+				explicit block(size_t count) noexcept :
+					count{ count }
+				{}
+
+			public:
+				struct deleter
+				{
+					void operator()(block *b) const noexcept
+					{
+						for (size_t index = 0; index < b->count; ++index)
+							b->nodes()[index].~node_t();
+						b->~block();
+						::operator delete(b);
+					}
+				};
+
+				static block *create(size_t count)
+				{
+					auto memory = static_cast<char *>(::operator new(nodes_offset() + count * sizeof(node_t)));
+					auto b = new (memory) block{ count };
+					for (size_t index = 0; index < count; ++index)
+						new (b->nodes() + index) node_t{};
+					return b;
+				}
+
+				node_t *nodes() noexcept
+				{
+					return reinterpret_cast<node_t *>(reinterpret_cast<char *>(this) + nodes_offset());
+				}
+
+				bool start(continuation handle, Range &range) noexcept
+				{
+					return when_all_base::start(handle, count, [&]() noexcept
+					{
+						size_t index = 0;
+						for (auto &child : range)
+							nodes()[index++].start(this, child);
+					});
+				}
+			};
+
+			using child_result_t = decltype(std::declval<typename block::node_t &>().get());
+
+			Range range;
+			size_t size{ 0 };
+			std::unique_ptr<block, typename block::deleter> state;
+
+		public:
+			when_all_range_awaitable(Range &&range) :
+				range{ std::forward<Range>(range) }
+			{
+				for (auto &&child : this->range)
+				{
+					(void)child;
+					++size;
+				}
+			}
+
+			bool await_ready() const noexcept
+			{
+				return size == 0;
+			}
+
+			bool await_suspend(coro::coroutine_handle<> handle)
+			{
+				return await_suspend(continuation{ handle });
+			}
+
+			bool await_suspend(continuation handle)
+			{
+				state.reset(block::create(size));
+				return state->start(handle, range);
+			}
+
+			auto await_resume()
+			{
+				const auto nodes = state ? state->nodes() : nullptr;
+				if constexpr (std::is_void_v<child_result_t>)
+				{
+					for (size_t index = 0; index < size; ++index)
+						nodes[index].get();
+				}
+				else
+				{
+					std::vector<std::decay_t<child_result_t>> results;
+					results.reserve(size);
+					for (size_t index = 0; index < size; ++index)
+						results.push_back(nodes[index].get());
+					return results;
+				}
+			}
+
+			// cancels all children that support cancellation
+			void cancel() noexcept
+			{
+				for (auto &child : range)
+					cancel_awaitable(child);
+			}
+		};
+
+		template<class Range, std::enable_if_t<is_range_v<Range>, int> = 0>
+		inline auto when_all(Range &&range)
+		{
+			using reference = decltype(*std::begin(range));
+			if constexpr (std::is_lvalue_reference_v<reference>)
+				return when_all_range_awaitable<Range>{ std::forward<Range>(range) };
+			else
+			{
+				// single pass or generated children are collected first
+				std::vector<std::decay_t<reference>> children;
+				for (auto &&child : range)
+					children.push_back(std::forward<decltype(child)>(child));
+				return when_all(std::move(children));
+			}
+		}
+
+		///////////////////////////////////
+
+		// when_any
+		// One intrusively counted block holds the children, their nodes, the winner index and the awaiting coroutine. It is
+		// referenced by the awaitable, by every running child and by the start loop, and is freed by the last of them.
+		// The first child to complete becomes the winner and cancels the others; results of other children are discarded.
+		template<class Derived>
+		class when_any_block_base
+		{
+		protected:
+			static constexpr size_t no_winner = ~size_t{};
+
+		private:
+			std::atomic<size_t> references{ 1 };
+			std::atomic<size_t> winner{ no_winner };
+			std::atomic<int> resume_guard{ 2 };	// the winner and the end of the start loop
+			continuation resume;
+
+			Derived *derived() noexcept
+			{
+				return static_cast<Derived *>(this);
+			}
+
+		public:
+			void release() noexcept
+			{
+				if (1 == references.fetch_sub(1, std::memory_order_acq_rel))
+					Derived::destroy(derived());
+			}
+
+			// returns true if the awaiting coroutine has to suspend
+			bool start(continuation handle) noexcept
+			{
+				trace(trace_event::when_any_started, this, static_cast<uint32_t>(derived()->size()));
+				resume = handle;
+				references.fetch_add(derived()->size() + 1, std::memory_order_relaxed);
+				derived()->start_children();
+				release();
+				return 1 != resume_guard.fetch_sub(1, std::memory_order_acq_rel);
+			}
+
+			template<class Node>
+			coro::coroutine_handle<> finished(Node *node) noexcept
+			{
+				coro::coroutine_handle<> handle{ nullptr };
+				auto expected = no_winner;
+				const auto index = derived()->index_of(node);
+				if (winner.compare_exchange_strong(expected, index, std::memory_order_acq_rel))
+				{
+					trace(trace_event::when_any_completed, this, static_cast<uint32_t>(index));
+					// the winner still holds its reference, so the block survives losers completing from cancellation
+					derived()->cancel_children(index);
+					if (1 == resume_guard.fetch_sub(1, std::memory_order_acq_rel))
+						handle = resume.get();
+				}
+				else
+				{
+					try
+					{
+						node->get();
+					}
+					catch (...)
+					{
+					}
+				}
+				release();
+				return handle;
+			}
+
+			size_t get_index() const noexcept
+			{
+				return winner.load(std::memory_order_relaxed);
+			}
+
+			void cancel() noexcept
+			{
+				derived()->cancel_children(no_winner);
+			}
+		};
+
+		template<class...Awaitables>
+		class when_any_block : public when_any_block_base<when_any_block<Awaitables...>>
+		{
+			using base = when_any_block_base<when_any_block>;
+			friend base;
+
+			std::tuple<std::decay_t<Awaitables>...> awaitables;
+			std::tuple<awaiter_node<when_any_block, std::decay_t<Awaitables>>...> nodes;
+
+			static void destroy(when_any_block *block) noexcept
+			{
+				delete block;
+			}
+
+			static constexpr size_t size() noexcept
+			{
+				return sizeof...(Awaitables);
+			}
+
+			template<size_t...I>
+			void start_children(std::index_sequence<I...>) noexcept
+			{
+				(std::get<I>(nodes).start(this, std::get<I>(awaitables)), ...);
+			}
+
+			void start_children() noexcept
+			{
+				start_children(std::index_sequence_for<Awaitables...>{});
+			}
+
+			template<size_t...I>
+			void cancel_children(size_t except, std::index_sequence<I...>) noexcept
+			{
+				((I != except ? cancel_awaitable(std::get<I>(awaitables)) : void()), ...);
+			}
+
+			void cancel_children(size_t except) noexcept
+			{
+				cancel_children(except, std::index_sequence_for<Awaitables...>{});
+			}
+
+			template<class Node, size_t...I>
+			size_t index_of(const Node *node, std::index_sequence<I...>) const noexcept
+			{
+				size_t index = 0;
+				((static_cast<const void *>(node) == &std::get<I>(nodes) ? (void)(index = I) : void()), ...);
+				return index;
+			}
+
+			template<class Node>
+			size_t index_of(const Node *node) const noexcept
+			{
+				return index_of(node, std::index_sequence_for<Awaitables...>{});
+			}
+
+		public:
+			using result_t = std::decay_t<awaiter_node_result_t<when_any_block, get_first_t<Awaitables...>>>;
+
+		private:
+			template<size_t I>
+			auto get_winner(size_t index) -> result_t
+			{
+				if constexpr (I + 1 < sizeof...(Awaitables))
+				{
+					if (index != I)
+						return get_winner<I + 1>(index);
+				}
+				return std::get<I>(nodes).get();
+			}
+
+		public:
+			when_any_block(Awaitables &&...awaitables) :
+				awaitables{ std::forward<Awaitables>(awaitables)... }
+			{}
+
+			result_t get_result()
+			{
+				return get_winner<0>(this->get_index());
+			}
+		};
+
+		// The range version keeps the block, copies of children and their nodes in a single allocation.
+		template<class Child>
+		class when_any_range_block : public when_any_block_base<when_any_range_block<Child>>
+		{
+			using base = when_any_block_base<when_any_range_block>;
+			friend base;
+			using node_t = awaiter_node<when_any_range_block, Child>;
+
+			static_assert(alignof(Child) <= alignof(std::max_align_t) && alignof(node_t) <= alignof(std::max_align_t), "over-aligned awaitables are not supported");
+
+			size_t count;
+			Child *children{ nullptr };
+			node_t *nodes{ nullptr };
+
+			static constexpr size_t align(size_t offset, size_t alignment) noexcept
+			{
+				return (offset + alignment - 1) / alignment * alignment;
+			}
+
+			static constexpr size_t children_offset() noexcept
+			{
+				return align(sizeof(when_any_range_block), alignof(Child));
+			}
+
+			static constexpr size_t nodes_offset(size_t count) noexcept
+			{
+				return align(children_offset() + count * sizeof(Child), alignof(node_t));
+			}
+
+			explicit when_any_range_block(size_t count) noexcept :
+				count{ count }
+			{}
+
+			static void destroy(when_any_range_block *block) noexcept
+			{
+				for (size_t index = 0; index < block->count; ++index)
+				{
+					block->nodes[index].~node_t();
+					block->children[index].~Child();
+				}
+				block->~when_any_range_block();
+				::operator delete(block);
+			}
+
+			size_t size() const noexcept
+			{
+				return count;
+			}
+
+			void start_children() noexcept
+			{
+				for (size_t index = 0; index < count; ++index)
+					nodes[index].start(this, children[index]);
+			}
+
+			void cancel_children(size_t except) noexcept
+			{
+				for (size_t index = 0; index < count; ++index)
+				{
+					if (index != except)
+						cancel_awaitable(children[index]);
+				}
+			}
+
+			size_t index_of(const node_t *node) const noexcept
+			{
+				return static_cast<size_t>(node - nodes);
+			}
+
+		public:
+			using result_t = std::decay_t<awaiter_node_result_t<when_any_range_block, Child>>;
+
+			// children are moved from an rvalue range and copied otherwise
+			template<class Range>
+			static when_any_range_block *create(Range &&range, size_t count)
+			{
+				auto memory = static_cast<char *>(::operator new(nodes_offset(count) + count * sizeof(node_t)));
+				auto block = new (memory) when_any_range_block{ count };
+				auto children = reinterpret_cast<Child *>(memory + children_offset());
+				size_t constructed = 0;
+				try
+				{
+					for (auto &&child : range)
+					{
+						if constexpr (std::is_lvalue_reference_v<Range>)
+							new (children + constructed) Child(child);
+						else
+							new (children + constructed) Child(std::move(child));
+						++constructed;
+					}
+				}
+				catch (...)
+				{
+					while (constructed)
+						children[--constructed].~Child();
+					block->~when_any_range_block();
+					::operator delete(memory);
+					throw;
+				}
+
+				block->children = children;
+				block->nodes = reinterpret_cast<node_t *>(memory + nodes_offset(count));
+				for (size_t index = 0; index < count; ++index)
+					new (block->nodes + index) node_t{};
+				return block;
+			}
+
+			result_t get_result()
+			{
+				return nodes[this->get_index()].get();
+			}
+		};
+
+		template<class Block>
+		class when_any_awaitable
+		{
+			Block *block;
+
+		public:
+			explicit when_any_awaitable(Block *block) noexcept :
+				block{ block }
+			{}
+
+			when_any_awaitable(when_any_awaitable &&o) noexcept :
+				block{ o.block }
+			{
+				o.block = nullptr;
+			}
+
+			when_any_awaitable(const when_any_awaitable &) = delete;
+			when_any_awaitable &operator =(const when_any_awaitable &) = delete;
+
+			~when_any_awaitable()
+			{
+				if (block)
+					block->release();
+			}
+
+			bool await_ready() const noexcept
+			{
+				return false;
+			}
+
+			bool await_suspend(coro::coroutine_handle<> handle) noexcept
+			{
+				return await_suspend(continuation{ handle });
+			}
+
+			bool await_suspend(continuation handle) noexcept
+			{
+				return block->start(handle);
+			}
+
+			// produces the index of the first completed child, or its result and index
+			auto await_resume()
+			{
+				if constexpr (std::is_void_v<typename Block::result_t>)
+				{
+					block->get_result();
+					return block->get_index();
+				}
+				else
+					return std::pair<typename Block::result_t, size_t>{ block->get_result(), block->get_index() };
+			}
+
+			// cancels all children that support cancellation
+			void cancel() noexcept
+			{
+				block->cancel();
+			}
+		};
+
+		template<class...Awaitables>
+		inline auto when_any(Awaitables &&...awaitables)
+		{
+			static_assert(sizeof...(Awaitables) >= 2, "when_any must be passed at least two arguments");
+			static_assert(are_all_same_v<decltype(get_result_type(awaitables))...>, "when_any requires all awaitables to produce the same type");
+
+			using block_t = when_any_block<Awaitables...>;
+			return when_any_awaitable<block_t>{ new block_t{ std::forward<Awaitables>(awaitables)... } };
+		}
+
+		// when_any over a range
+		// The range must not be empty. Children are copied (or moved from an rvalue range) into the block, because they
+		// continue to run after the awaiting coroutine is resumed.
+		template<class Range, std::enable_if_t<is_range_v<Range>, int> = 0>
+		inline auto when_any(Range &&range)
+		{
+			using reference = decltype(*std::begin(range));
+			using iterator_category = typename std::iterator_traits<decltype(std::begin(range))>::iterator_category;
+			if constexpr (std::is_lvalue_reference_v<reference> && std::is_base_of_v<std::forward_iterator_tag, iterator_category>)
+			{
+				using block_t = when_any_range_block<std::decay_t<reference>>;
+				const auto count = static_cast<size_t>(std::distance(std::begin(range), std::end(range)));
+				if (!count)
+					throw std::invalid_argument("when_any requires at least one awaitable");
+				return when_any_awaitable<block_t>{ block_t::create(std::forward<Range>(range), count) };
+			}
+			else
+			{
+				// single pass or generated children are collected first
+				std::vector<std::decay_t<reference>> children;
+				for (auto &&child : range)
+					children.push_back(std::forward<decltype(child)>(child));
+				return when_any(std::move(children));
+			}
+		}
+
+		// Structured group of concurrently running children
+		// co_await group.spawn(awaitable) starts a child and suspends the spawning coroutine while max_concurrency children
+		// are running. co_await group.join() resumes once every child has completed and rethrows the exception of the first
+		// child that failed. The first failure cancels the running children and drops later spawns. Children may spawn
+		// siblings; other coroutines must not spawn while the group is being joined.
+		// Children are driven by an awaiter_node, so future<T> children run without a coroutine frame. Running children
+		// are kept in a table of slots recycled through a lock-free stack, which lets the group cancel them. Spawning and
+		// completing a child takes a few atomic operations and no lock.
+		class task_group
+		{
+			static constexpr uint32_t empty = ~uint32_t{};
+			// chunk k of the slot table has first_chunk << k slots
+			static constexpr uint32_t first_chunk = 64;
+
+			// a running child holds one reference and its slot another, so cancel() may use a child that has just completed
+			struct child_base
+			{
+				task_group *group;
+				uint32_t slot;
+				std::atomic<uint32_t> references{ 2 };
+
+				child_base(task_group *group, uint32_t slot) noexcept :
+					group{ group },
+					slot{ slot }
+				{}
+
+				virtual ~child_base() = default;
+
+				virtual void cancel() noexcept = 0;
+
+				void release(uint32_t count) noexcept
+				{
+					if (references.fetch_sub(count, std::memory_order_acq_rel) == count)
+						delete this;
+				}
+			};
+
+			template<class Awaitable>
+			struct child final : child_base
+			{
+				Awaitable awaitable;
+				awaiter_node<child, Awaitable> node;
+
+				template<class A>
+				child(task_group *group, uint32_t slot, A &&awaitable) :
+					child_base{ group, slot },
+					awaitable{ std::forward<A>(awaitable) }
+				{}
+
+				// results are discarded, exceptions are reported to the group
+				coro::coroutine_handle<> finished(awaiter_node<child, Awaitable> *) noexcept
+				{
+					std::exception_ptr error;
+					try
+					{
+						(void)node.get();
+					}
+					catch (...)
+					{
+						error = std::current_exception();
+					}
+					return group->finished(this, std::move(error));
+				}
+
+				void cancel() noexcept override
+				{
+					cancel_awaitable(awaitable);
+				}
+			};
+
+			struct slot
+			{
+				std::atomic<child_base *> child{ nullptr };
+				std::atomic<uint32_t> next{ empty };
+			};
+
+			// running children plus one reference released by join
+			std::atomic<size_t> pending{ 1 };
+			std::atomic<bool> stopped{ false };
+			std::atomic<bool> failed{ false };
+			std::exception_ptr first_error;
+			continuation joiner;
+			bool bounded;
+			async_semaphore capacity;
+
+			std::array<std::atomic<slot *>, 26> chunks{};
+			std::atomic<uint32_t> next_slot{ 0 };
+			// free stack head: version in the upper half against ABA, slot index in the lower half
+			std::atomic<uint64_t> free_head{ empty };
+
+			static uint32_t chunk_of(uint32_t index) noexcept
+			{
+				uint32_t k = 0;
+				for (auto n = index / first_chunk + 1; n > 1; n >>= 1)
+					++k;
+				return k;
+			}
+
+			slot &at(uint32_t index) const noexcept
+			{
+				const auto k = chunk_of(index);
+				return chunks[k].load(std::memory_order_acquire)[index - first_chunk * ((uint32_t{ 1 } << k) - 1)];
+			}
+
+			uint32_t acquire_slot()
+			{
+				auto h = free_head.load(std::memory_order_acquire);
+				for (;;)
+				{
+					const auto index = static_cast<uint32_t>(h);
+					if (index == empty)
+						break;
+					const auto n = at(index).next.load(std::memory_order_relaxed);
+					if (free_head.compare_exchange_weak(h, ((h >> 32) + 1) << 32 | n, std::memory_order_acquire, std::memory_order_acquire))
+						return index;
+				}
+
+				// the table grows by doubling chunks, so a slot index is never invalidated
+				const auto index = next_slot.fetch_add(1, std::memory_order_relaxed);
+				if (index == empty)
+					throw std::length_error("too many children in task_group");
+				auto &chunk = chunks[chunk_of(index)];
+				if (!chunk.load(std::memory_order_acquire))
+				{
+					auto fresh = new slot[size_t{ first_chunk } << chunk_of(index)];
+					slot *expected = nullptr;
+					if (!chunk.compare_exchange_strong(expected, fresh, std::memory_order_acq_rel, std::memory_order_acquire))
+						delete[] fresh;
+				}
+				return index;
+			}
+
+			void release_slot(uint32_t index) noexcept
+			{
+				auto h = free_head.load(std::memory_order_relaxed);
+				do
+				{
+					at(index).next.store(static_cast<uint32_t>(h), std::memory_order_relaxed);
+				} while (!free_head.compare_exchange_weak(h, ((h >> 32) + 1) << 32 | index, std::memory_order_release, std::memory_order_relaxed));
+			}
+
+			// takes the child out of its slot and cancels it
+			static void cancel_slot(slot &s) noexcept
+			{
+				if (auto c = s.child.exchange(nullptr, std::memory_order_seq_cst))
+				{
+					c->cancel();
+					c->release(1);
+				}
+			}
+
+			coro::coroutine_handle<> release_pending() noexcept
+			{
+				if (pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+					return joiner.get();
+				return nullptr;
+			}
+
+			coro::coroutine_handle<> finished(child_base *c, std::exception_ptr error) noexcept
+			{
+				if (error && !failed.exchange(true, std::memory_order_acq_rel))
+				{
+					first_error = std::move(error);
+					cancel();
+				}
+
+				const auto index = c->slot;
+				const bool owns_slot = at(index).child.exchange(nullptr, std::memory_order_acq_rel) == c;
+				release_slot(index);
+				c->release(owns_slot ? 2 : 1);
+
+				if (bounded)
+					capacity.release();
+				// the last access to the group, because the joiner may destroy it
+				return release_pending();
+			}
+
+			template<class Awaitable>
+			void start(Awaitable &&awaitable)
+			{
+				using child_t = child<std::decay_t<Awaitable>>;
+
+				// a failed or cancelled group does not start new children
+				if (stopped.load(std::memory_order_acquire))
+				{
+					cancel_awaitable(awaitable);
+					if (bounded)
+						capacity.release();
+					return;
+				}
+
+				child_t *c;
+				try
+				{
+					const auto index = acquire_slot();
+					try
+					{
+						c = new child_t{ this, index, std::forward<Awaitable>(awaitable) };
+					}
+					catch (...)
+					{
+						release_slot(index);
+						throw;
+					}
+				}
+				catch (...)
+				{
+					if (bounded)
+						capacity.release();
+					throw;
+				}
+
+				// the extra reference keeps join from completing while the child is being started
+				pending.fetch_add(2, std::memory_order_relaxed);
+				auto &s = at(c->slot);
+				s.child.store(c, std::memory_order_seq_cst);
+				c->node.start(c, c->awaitable);
+				// the child may have missed cancel() that ran while it was being registered
+				if (stopped.load(std::memory_order_seq_cst))
+					cancel_slot(s);
+				if (auto handle = release_pending())
+					handle.resume();
+			}
+
+			template<class Awaitable>
+			class spawn_awaiter
+			{
+				using permit_t = decltype(std::declval<async_semaphore &>().acquire());
+
+				task_group *group;
+				Awaitable awaitable;
+				permit_t permit;
+
+			public:
+				template<class A>
+				spawn_awaiter(task_group *group, A &&awaitable) :
+					group{ group },
+					awaitable{ std::forward<A>(awaitable) },
+					permit{ group->capacity.acquire() }
+				{}
+
+				bool await_ready() noexcept
+				{
+					return !group->bounded || permit.await_ready();
+				}
+
+				bool await_suspend(continuation handle)
+				{
+					return permit.await_suspend(handle);
+				}
+
+				bool await_suspend(coro::coroutine_handle<> handle)
+				{
+					return permit.await_suspend(handle);
+				}
+
+				// the child is started by the spawning coroutine once it holds a permit
+				void await_resume()
+				{
+					group->start(std::move(awaitable));
+				}
+			};
+
+			class join_awaiter
+			{
+				task_group *group;
+
+			public:
+				explicit join_awaiter(task_group *group) noexcept :
+					group{ group }
+				{}
+
+				bool await_ready() const noexcept
+				{
+					return group->pending.load(std::memory_order_acquire) == 1;
+				}
+
+				bool await_suspend(continuation handle) noexcept
+				{
+					group->joiner = handle;
+					return group->pending.fetch_sub(1, std::memory_order_acq_rel) != 1;
+				}
+
+				bool await_suspend(coro::coroutine_handle<> handle) noexcept
+				{
+					return await_suspend(continuation{ handle });
+				}
+
+				// the group may be used again after it has been joined, with its failure and cancellation cleared
+				void await_resume() const
+				{
+					group->pending.store(1, std::memory_order_relaxed);
+					group->stopped.store(false, std::memory_order_relaxed);
+					if (group->failed.exchange(false, std::memory_order_acquire))
+						std::rethrow_exception(std::exchange(group->first_error, nullptr));
+				}
+			};
+
+		public:
+			// max_concurrency of 0 does not limit the number of running children
+			explicit task_group(size_t max_concurrency = 0) noexcept :
+				bounded{ max_concurrency != 0 },
+				capacity{ max_concurrency < PTRDIFF_MAX ? static_cast<ptrdiff_t>(max_concurrency) : PTRDIFF_MAX }
+			{}
+
+			task_group(const task_group &) = delete;
+			task_group &operator =(const task_group &) = delete;
+
+			// the group must be joined before it is destroyed
+			~task_group()
+			{
+				assert(pending.load(std::memory_order_relaxed) == 1);
+				for (auto &chunk : chunks)
+					delete[] chunk.load(std::memory_order_relaxed);
+			}
+
+			// co_await spawn(awaitable) starts the child, waiting for a free place if the group is full
+			template<class Awaitable>
+			auto spawn(Awaitable &&awaitable)
+			{
+				return spawn_awaiter<std::decay_t<Awaitable>>{ this, std::forward<Awaitable>(awaitable) };
+			}
+
+			// co_await join() waits for all children and rethrows the first failure
+			join_awaiter join() noexcept
+			{
+				return join_awaiter{ this };
+			}
+
+			// cancels all running children that support cancellation; later spawns are dropped
+			void cancel() noexcept
+			{
+				stopped.store(true, std::memory_order_seq_cst);
+				for (uint32_t k = 0; k < chunks.size(); ++k)
+				{
+					if (auto chunk = chunks[k].load(std::memory_order_acquire))
+					{
+						for (size_t i = 0; i < (size_t{ first_chunk } << k); ++i)
+							cancel_slot(chunk[i]);
+					}
+				}
+			}
+
+			bool is_cancelled() const noexcept
+			{
+				return stopped.load(std::memory_order_acquire);
+			}
+		};
+
+#if defined(_WIN32)
+		//////////////////////////////
+		// Simplified versions of IAsyncAction and IAsyncOperation that do not force return to original thread context
+		template <typename Async>
+		struct await_adapter
+		{
+			const Async & async;
+
+			bool await_ready() const
+			{
+				return async.Status() == winrt::Windows::Foundation::AsyncStatus::Completed;
+			}
+
+			void await_suspend(coro::coroutine_handle<> handle) const
+			{
+				async.Completed([handle](const auto &, winrt::Windows::Foundation::AsyncStatus)
+				{
+					handle();
+				});
+			}
+
+			auto await_resume() const
+			{
+				return async.GetResults();
+			}
+		};
+
+		// start & start_async
+		// methods "starts" an asynchronous operation that only starts in await_suspend
+		struct default_policy
+		{
+			template<class T>
+			struct promise
+			{
+				template<class Awaitable>
+				static ::winrt::Windows::Foundation::IAsyncOperation<T> start(Awaitable awaitable)
+				{
+					auto result = co_await awaitable;
+					co_return result;
+				}
+
+				static ::winrt::Windows::Foundation::IAsyncOperation<T> wait(winrt::Windows::Foundation::TimeSpan timeout)
+				{
+					co_await ::winrt::resume_after{ timeout };
+					throw ::winrt::hresult_canceled{};
+				}
+			};
+		};
+
+		template<>
+		struct default_policy::promise<void>
+		{
+			template<class Awaitable>
+			static ::winrt::Windows::Foundation::IAsyncAction start(Awaitable awaitable)
+			{
+				co_await awaitable;
+			}
+
+			static ::winrt::Windows::Foundation::IAsyncAction wait(::winrt::Windows::Foundation::TimeSpan timeout)
+			{
+				co_await ::winrt::resume_after{ timeout };
+				throw ::winrt::hresult_canceled{};
+			}
+		};
+#endif
+
+		struct ex_policy
+		{
+			template<class T>
+			struct promise
+			{
+				template<class Awaitable>
+				static future<T> start(Awaitable awaitable)
+				{
+					co_return co_await awaitable;
+				}
+			};
+		};
+
+		template<>
+		struct ex_policy::promise<void>
+		{
+			template<class Awaitable>
+			static future<void> start(Awaitable awaitable)
+			{
+				co_await awaitable;
+			}
+		};
+
+		// Work-stealing thread pool
+		// Every worker owns a Chase-Lev deque: it pushes and pops continuations at the bottom, idle workers steal from the
+		// top. Continuations posted from other threads go to a global FIFO injection queue. Workers that find no work park
+		// on a condition variable and are woken up one at a time when work is posted.
+		class thread_pool
+		{
+			// Chase-Lev deque of coroutine addresses
+			// Buffers replaced on growth are kept until the deque is destroyed, because thieves may still read them.
+			class work_deque
+			{
+				struct buffer
+				{
+					int64_t capacity;
+					std::unique_ptr<std::atomic<void *>[]> items;
+
+					explicit buffer(int64_t capacity) :
+						capacity{ capacity },
+						items{ new std::atomic<void *>[static_cast<size_t>(capacity)] }
+					{}
+
+					void put(int64_t index, void *item) noexcept
+					{
+						items[static_cast<size_t>(index & (capacity - 1))].store(item, std::memory_order_relaxed);
+					}
+
+					void *get(int64_t index) const noexcept
+					{
+						return items[static_cast<size_t>(index & (capacity - 1))].load(std::memory_order_relaxed);
+					}
+				};
+
+				std::atomic<int64_t> top{ 0 };
+				std::atomic<int64_t> bottom{ 0 };
+				std::atomic<buffer *> items;
+				std::vector<std::unique_ptr<buffer>> buffers;
+
+			public:
+				work_deque()
+				{
+					buffers.push_back(std::make_unique<buffer>(256));
+					items.store(buffers.back().get(), std::memory_order_relaxed);
+				}
+
+				// owner only
+				void push(void *item)
+				{
+					const auto b = bottom.load(std::memory_order_relaxed);
+					const auto t = top.load(std::memory_order_acquire);
+					auto a = items.load(std::memory_order_relaxed);
+					if (b - t > a->capacity - 1)
+					{
+						buffers.push_back(std::make_unique<buffer>(a->capacity * 2));
+						auto grown = buffers.back().get();
+						for (auto i = t; i < b; ++i)
+							grown->put(i, a->get(i));
+						items.store(grown, std::memory_order_release);
+						a = grown;
+					}
+					a->put(b, item);
+					bottom.store(b + 1, std::memory_order_release);
+				}
+
+				// owner only
+				void *pop() noexcept
+				{
+					const auto b = bottom.load(std::memory_order_relaxed) - 1;
+					auto a = items.load(std::memory_order_relaxed);
+					bottom.store(b, std::memory_order_seq_cst);
+					auto t = top.load(std::memory_order_seq_cst);
+					if (t > b)
+					{
+						bottom.store(b + 1, std::memory_order_relaxed);
+						return nullptr;
+					}
+
+					auto item = a->get(b);
+					if (t == b)
+					{
+						// last item: race with thieves
+						if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+							item = nullptr;
+						bottom.store(b + 1, std::memory_order_relaxed);
+					}
+					return item;
+				}
+
+				void *steal() noexcept
+				{
+					auto t = top.load(std::memory_order_seq_cst);
+					const auto b = bottom.load(std::memory_order_seq_cst);
+					if (t >= b)
+						return nullptr;
+
+					auto item = items.load(std::memory_order_acquire)->get(t);
+					if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+						return nullptr;
+					return item;
+				}
+
+				bool empty() const noexcept
+				{
+					return top.load(std::memory_order_acquire) >= bottom.load(std::memory_order_acquire);
+				}
+			};
+
+			struct worker
+			{
+				thread_pool *pool;
+				size_t index;
+				work_deque deque;
+				uint32_t random;
+				std::thread thread;
+			};
+
+			std::vector<std::unique_ptr<worker>> workers;
+
+			srwlock injection_lock;
+			std::deque<void *> injection;	// FIFO, so that continuations posted from other threads are not starved
+			std::atomic<size_t> injection_size{ 0 };
+			std::atomic<size_t> foreign_posts{ 0 };	// post() calls from other threads still touching the pool
+
+			std::mutex park_lock;
+			std::condition_variable park_cv;
+			std::atomic<size_t> idle{ 0 };
+			size_t sleeping{ 0 };			// guarded by park_lock, as is wakeups
+			size_t wakeups{ 0 };
+			std::atomic<bool> stopping{ false };
+
+			static worker *&current() noexcept
+			{
+				static thread_local worker *instance{ nullptr };
+				return instance;
+			}
+
+			void *pop_injected() noexcept
+			{
+				if (!injection_size.load(std::memory_order_acquire))
+					return nullptr;
+
+				const std::lock_guard<srwlock> l(injection_lock);
+				if (injection.empty())
+					return nullptr;
+				auto item = injection.front();
+				injection.pop_front();
+				injection_size.store(injection.size(), std::memory_order_release);
+				return item;
+			}
+
+			void *steal(worker &self) noexcept
+			{
+				// xorshift picks the first victim
+				self.random ^= self.random << 13;
+				self.random ^= self.random >> 17;
+				self.random ^= self.random << 5;
+
+				const auto count = workers.size();
+				const auto start = self.random % count;
+				for (size_t i = 0; i < count; ++i)
+				{
+					auto &victim = *workers[(start + i) % count];
+					if (&victim != &self)
+					{
+						if (auto item = victim.deque.steal())
+							return item;
+					}
+				}
+				return nullptr;
+			}
+
+			bool has_work() const noexcept
+			{
+				if (injection_size.load(std::memory_order_acquire))
+					return true;
+				for (auto &w : workers)
+				{
+					if (!w->deque.empty())
+						return true;
+				}
+				return false;
+			}
+
+			// The read-modify-write of idle orders the preceding push against a worker going to sleep. A worker checks for
+			// work under park_lock before it sleeps, so a post either is seen by that check or finds the worker sleeping.
+			void notify() noexcept
+			{
+				if (idle.fetch_add(0, std::memory_order_seq_cst))
+				{
+					const std::lock_guard<std::mutex> l(park_lock);
+					if (wakeups < sleeping)
+					{
+						++wakeups;
+						park_cv.notify_one();
+					}
+				}
+			}
+
+			void park() noexcept
+			{
+				idle.fetch_add(1, std::memory_order_seq_cst);
+				{
+					std::unique_lock<std::mutex> l(park_lock);
+					if (!has_work() && !stopping.load(std::memory_order_relaxed))
+					{
+						++sleeping;
+						park_cv.wait(l, [this]
+						{
+							return wakeups || stopping.load(std::memory_order_relaxed);
+						});
+						--sleeping;
+						if (wakeups)
+							--wakeups;
+					}
+				}
+				idle.fetch_sub(1, std::memory_order_relaxed);
+			}
+
+			void run(worker &self) noexcept
+			{
+				current() = &self;
+				for (;;)
+				{
+					auto item = self.deque.pop();
+					if (!item)
+						item = pop_injected();
+					if (!item)
+						item = steal(self);
+
+					if (item)
+					{
+						add_metric(metric::pool_queued, -1);
+						const watchdog_scope scope{ "thread_pool", item };
+						coro::coroutine_handle<>::from_address(item).resume();
+					}
+					else if (stopping.load(std::memory_order_acquire) && !has_work())
+						break;
+					else
+						park();
+				}
+				current() = nullptr;
+			}
+
+		public:
+			explicit thread_pool(size_t threads = std::thread::hardware_concurrency())
+			{
+				if (!threads)
+					threads = 1;
+
+				workers.reserve(threads);
+				for (size_t index = 0; index < threads; ++index)
+					workers.push_back(std::unique_ptr<worker>{ new worker{ this, index, {}, static_cast<uint32_t>(index * 2654435761u + 1), {} } });
+
+				try
+				{
+					for (auto &w : workers)
+						w->thread = std::thread{ [this, &w = *w]
+						{
+							run(w);
+						} };
+				}
+				catch (...)
+				{
+					stop();
+					throw;
+				}
+			}
+
+			thread_pool(const thread_pool &) = delete;
+			thread_pool &operator =(const thread_pool &) = delete;
+
+			// runs all posted continuations before returning
+			~thread_pool()
+			{
+				stop();
+			}
+
+			static thread_pool &get_default()
+			{
+				static thread_pool instance;
+				return instance;
+			}
+
+			size_t size() const noexcept
+			{
+				return workers.size();
+			}
+
+			// true if called from one of the workers of this pool
+			bool is_current() const noexcept
+			{
+				auto w = current();
+				return w && w->pool == this;
+			}
+
+			// resume the coroutine on one of the workers
+			void post(coro::coroutine_handle<> handle)
+			{
+				add_metric(metric::pool_queued);
+				auto w = current();
+				if (w && w->pool == this)
+				{
+					w->deque.push(handle.address());
+					notify();
+				}
+				else
+				{
+					// the posted coroutine may complete and let its owner destroy the pool before this call returns
+					foreign_posts.fetch_add(1, std::memory_order_relaxed);
+					{
+						const std::lock_guard<srwlock> l(injection_lock);
+						injection.push_back(handle.address());
+						injection_size.store(injection.size(), std::memory_order_release);
+					}
+					notify();
+					foreign_posts.fetch_sub(1, std::memory_order_release);
+				}
+			}
+
+			// co_await pool.schedule() continues the coroutine on the pool
+			auto schedule() noexcept
+			{
+				struct awaiter
+				{
+					thread_pool *pool;
+
+					static bool await_ready() noexcept
+					{
+						return false;
+					}
+
+					void await_suspend(coro::coroutine_handle<> handle)
+					{
+						pool->post(handle);
+					}
+
+					static void await_resume() noexcept
+					{
+					}
+				};
+
+				return awaiter{ this };
+			}
+
+		private:
+			void stop() noexcept
+			{
+				{
+					const std::lock_guard<std::mutex> l(park_lock);
+					stopping.store(true, std::memory_order_release);
+				}
+				park_cv.notify_all();
+				for (auto &w : workers)
+				{
+					if (w->thread.joinable())
+						w->thread.join();
+				}
+				while (foreign_posts.load(std::memory_order_acquire))
+					std::this_thread::yield();
+			}
+		};
+
+		// co_await resume_on(pool) continues the coroutine on the pool
+		inline auto resume_on(thread_pool &pool) noexcept
+		{
+			return pool.schedule();
+		}
+
+		// start<pool_policy>(awaitable) starts the operation and resumes its awaiter on the default thread pool, which keeps
+		// continuations off the thread that completed the operation, such as a timer or I/O completion thread
+		struct pool_policy
+		{
+			template<class T>
+			struct promise
+			{
+				template<class Awaitable>
+				static future<T> start(Awaitable awaitable)
+				{
+					auto result = co_await awaitable;
+					co_await thread_pool::get_default().schedule();
+					co_return result;
+				}
+			};
+		};
+
+		template<>
+		struct pool_policy::promise<void>
+		{
+			template<class Awaitable>
+			static future<void> start(Awaitable awaitable)
+			{
+				co_await awaitable;
+				co_await thread_pool::get_default().schedule();
+			}
+		};
+
+		// Multi-consumer future
+		// shared_future<T> may be copied and awaited by any number of coroutines. Every awaiter pushes a node that lives in
+		// its own frame onto a lock-free stack. The coroutine takes the stack over at its final suspend point and resumes
+		// the awaiters in order of arrival, the last one by symmetric transfer. An awaiter may ask to be resumed on a
+		// thread_pool instead, so that a completion with many awaiters does not run all of them on the completing thread.
+		template<class T>
+		class shared_future
+		{
+			struct waiter_node
+			{
+				waiter_node *next{ nullptr };
+				continuation resume;
+				thread_pool *scheduler{ nullptr };
+			};
+
+			struct promise_type_ : promise_base<T>, frame_allocated
+			{
+				std::atomic<void *> waiters{ nullptr };	// stack of waiter nodes, the promise itself once completed
+
+				promise_type_() noexcept
+				{
+					trace(trace_event::future_created, static_cast<promise_base0 *>(this));
+					add_metric(metric::futures_alive);
+				}
+
+				~promise_type_()
+				{
+					trace(trace_event::future_destroyed, static_cast<promise_base0 *>(this));
+					add_metric(metric::futures_alive, -1);
+				}
+
+				static coro::suspend_never initial_suspend() noexcept
+				{
+					return {};
+				}
+
+				auto final_suspend() noexcept
+				{
+					struct awaiter
+					{
+						promise_type_ *pthis;
+
+						static bool await_ready() noexcept
+						{
+							return false;
+						}
+
+						coro::coroutine_handle<> await_suspend(coro::coroutine_handle<> handle) const noexcept
+						{
+							trace(trace_event::future_completed, static_cast<promise_base0 *>(pthis));
+							const auto next = pthis->resume_waiters();
+							if (pthis->state.fetch_or(final_suspended, std::memory_order_acq_rel) & future_detached)
+								handle.destroy();
+							return or_noop(next);
+						}
+
+						static void await_resume() noexcept
+						{
+						}
+					};
+					return awaiter{ this };
+				}
+
+				shared_future<T> get_return_object() noexcept
+				{
+					return { this };
+				}
+
+				// returns false if the result is already available and the awaiter must not suspend
+				bool push(waiter_node *node) noexcept
+				{
+					auto head = waiters.load(std::memory_order_acquire);
+					do
+					{
+						if (head == this)
+							return false;
+						node->next = static_cast<waiter_node *>(head);
+					} while (!waiters.compare_exchange_weak(head, node, std::memory_order_release, std::memory_order_acquire));
+					trace(trace_event::future_suspended, static_cast<promise_base0 *>(this));
+					return true;
+				}
+
+				// resumes or schedules all waiters but the last one, which is returned
+				coro::coroutine_handle<> resume_waiters() noexcept
+				{
+					auto node = static_cast<waiter_node *>(waiters.exchange(this, std::memory_order_acq_rel));
+
+					waiter_node *ordered = nullptr;
+					while (node)
+						ordered = std::exchange(node, std::exchange(node->next, ordered));
+
+					// a node lives in the frame of its awaiter and must not be touched once that is resumed
+					while (ordered)
+					{
+						const auto current = std::exchange(ordered, ordered->next);
+						trace(trace_event::future_resumed, static_cast<promise_base0 *>(this));
+						const auto scheduler = current->scheduler;
+						auto handle = current->resume.get();
+						if (handle && scheduler)
+						{
+							scheduler->post(handle);
+							handle = nullptr;
+						}
+						if (!ordered)
+							return handle;
+						if (handle)
+							handle.resume();
+					}
+					return nullptr;
+				}
+
+				void add_ref() noexcept
+				{
+					this->use_count.fetch_add(1, std::memory_order_relaxed);
+				}
+
+				void release() noexcept
+				{
+					if (1 == this->use_count.fetch_sub(1, std::memory_order_acq_rel))
+						destroy();
+				}
+
+				void destroy() noexcept
+				{
+					if (this->state.fetch_or(future_detached, std::memory_order_acq_rel) & final_suspended)
+						coro::coroutine_handle<promise_type_>::from_promise(*this).destroy();
+				}
+			};
+
+			promise_type_ *promise;
+
+			shared_future(promise_type_ *promise) noexcept :
+				promise{ promise }
+			{}
+
+			class awaiter
+			{
+				promise_type_ *promise;
+				waiter_node node;
+
+			public:
+				awaiter(promise_type_ *promise, thread_pool *scheduler) noexcept :
+					promise{ promise }
+				{
+					node.scheduler = scheduler;
+				}
+
+				bool await_ready() const noexcept
+				{
+					return promise->is_ready() && !node.scheduler;
+				}
+
+				bool await_suspend(coro::coroutine_handle<> resume)
+				{
+					return await_suspend(continuation{ resume });
+				}
+
+				bool await_suspend(continuation resume)
+				{
+					node.resume = resume;
+					if (promise->push(&node))
+						return true;
+					if (!node.scheduler)
+						return false;
+					if (auto handle = resume.get())
+						node.scheduler->post(handle);
+					return true;
+				}
+
+				decltype(auto) await_resume() const
+				{
+					if constexpr (std::is_void_v<T>)
+						promise->get();
+					else
+						return static_cast<const T &>(promise->get());
+				}
+			};
+
+			template<class Awaitable>
+			static shared_future<T> from(Awaitable awaitable)
+			{
+				if constexpr (std::is_void_v<T>)
+					co_await awaitable;
+				else
+					co_return co_await awaitable;
+			}
+
+		public:
+			using promise_type = promise_type_;
+
+			// shares the result of an awaitable, such as a future<T>
+			template<class Awaitable, std::enable_if_t<!std::is_same_v<std::decay_t<Awaitable>, shared_future>, int> = 0>
+			explicit shared_future(Awaitable &&awaitable) :
+				shared_future{ from(std::forward<Awaitable>(awaitable)) }
+			{}
+
+			~shared_future()
+			{
+				if (promise)
+					promise->release();
+			}
+
+			shared_future(const shared_future &o) noexcept :
+				promise{ o.promise }
+			{
+				if (promise)
+					promise->add_ref();
+			}
+
+			shared_future(shared_future &&o) noexcept :
+				promise{ std::exchange(o.promise, nullptr) }
+			{}
+
+			shared_future &operator =(shared_future o) noexcept
+			{
+				std::swap(promise, o.promise);
+				return *this;
+			}
+
+			bool is_ready() const noexcept
+			{
+				return promise->is_ready();
+			}
+
+			// blocks until the result is available; spin_count bounds the busy-wait that precedes blocking
+			void wait(unsigned spin_count = 0) const noexcept
+			{
+				promise->wait_ready(spin_count);
+			}
+
+			// returns true if the result became available within the timeout
+			template<class Rep, class Period>
+			bool wait_for(const std::chrono::duration<Rep, Period> &timeout) const noexcept
+			{
+				const auto deadline = std::chrono::steady_clock::now() + std::chrono::ceil<std::chrono::steady_clock::duration>(timeout);
+				return promise->wait_ready(0, &deadline);
+			}
+
+			decltype(auto) get(unsigned spin_count = 0) const
+			{
+				wait(spin_count);
+				return awaiter{ promise, nullptr }.await_resume();
+			}
+
+			// co_await on a shared_future resumes the awaiter on the thread that completes it
+			awaiter operator co_await() const noexcept
+			{
+				return { promise, nullptr };
+			}
+
+			// co_await f.resume_on(pool) resumes the awaiter on the pool
+			awaiter resume_on(thread_pool &pool) const noexcept
+			{
+				return { promise, &pool };
+			}
+		};
+
+		template<class Policy,class Awaitable>
+		inline auto start(Awaitable &&awaitable)
+		{
+			using promise_wrapper_t = typename Policy::template promise<std::decay_t<decltype(std::declval<Awaitable &>().await_resume())>>;
+			return promise_wrapper_t::start(std::forward<Awaitable>(awaitable));
+		}
+
+#if defined(_WIN32)
+		template<class Awaitable>
+		inline auto start(const Awaitable &awaitable)
+		{
+			return start<default_policy>(awaitable);
+		}
+#endif
+
+		template<class Awaitable>
+		inline auto start_async(Awaitable &&awaitable)
+		{
+			return start<ex_policy>(std::forward<Awaitable>(awaitable));
+		}
+
+		// Hierarchical timer wheel
+		// Timers are intrusive entries linked into one of four levels of 64 slots, so arming and cancelling are O(1) and never
+		// allocate. A single thread advances the wheel with a fixed resolution and cascades higher levels down. It only wakes
+		// up for non-empty slots and level boundaries and sleeps while no timer is armed. Expired callbacks run on a
+		// thread_pool, so a callback that does real work does not delay other timers.
+		// Arming and cancelling take one mutex per wheel. Programs that arm timers from many threads at a high rate may
+		// spread them over several wheels.
+		class timer_wheel
+		{
+			static constexpr unsigned level_bits = 6;
+			static constexpr uint64_t slots = uint64_t{ 1 } << level_bits;
+			static constexpr uint64_t slot_mask = slots - 1;
+			static constexpr unsigned levels = 4;
+			static constexpr uint64_t max_delta = (uint64_t{ 1 } << (level_bits * levels)) - 1;
+
+			// circular intrusive list
+			struct link
+			{
+				link *next{ this };
+				link *prev{ this };
+
+				link() noexcept = default;
+				link(const link &) = delete;
+				link &operator =(const link &) = delete;
+
+				bool empty() const noexcept
+				{
+					return next == this;
+				}
+
+				void push_back(link *node) noexcept
+				{
+					node->prev = prev;
+					node->next = this;
+					prev->next = node;
+					prev = node;
+				}
+
+				void unlink() noexcept
+				{
+					prev->next = next;
+					next->prev = prev;
+					next = prev = this;
+				}
+
+				void move_to(link &target) noexcept
+				{
+					if (!empty())
+					{
+						target.next = next;
+						target.prev = prev;
+						next->prev = &target;
+						prev->next = &target;
+						next = prev = this;
+					}
+				}
+			};
+
+		public:
+			// Timer entry, usually embedded in the object that owns the timer
+			class timer : link
+			{
+				friend timer_wheel;
+				enum class state_t
+				{
+					idle,
+					armed,
+					pending
+				};
+
+				timer_wheel *wheel;
+				void (*callback)(void *) noexcept;
+				void *context;
+				uint64_t expiry{};
+				state_t state{ state_t::idle };
+
+			public:
+				timer(void (*callback)(void *) noexcept, void *context, timer_wheel &wheel = timer_wheel::get_default()) noexcept :
+					wheel{ &wheel },
+					callback{ callback },
+					context{ context }
+				{}
+
+				~timer()
+				{
+					cancel();
+				}
+
+				// arm or re-arm the timer
+				void set(TimeSpan due)
+				{
+					wheel->arm(*this, due);
+				}
+
+				// Disarm the timer. If the callback is running, waits for it to finish unless called from the callback itself.
+				// Returns true if the timer has been disarmed before its callback was called.
+				bool cancel() noexcept
+				{
+					return wheel->cancel(*this);
+				}
+			};
+
+		private:
+			using clock = std::chrono::steady_clock;
+
+			// callback running on a pool thread, lives on the stack of run_pending
+			struct running_entry
+			{
+				const timer *t;
+				std::thread::id thread;
+				running_entry *next;
+			};
+
+			std::mutex lock;
+			std::condition_variable wake;
+			std::condition_variable done;
+			link wheel[levels][slots];
+			link pending;
+			running_entry *running{ nullptr };
+			uint64_t tick{};				// next tick to process
+			uint64_t sleeping_until{ ~uint64_t{} };
+			size_t armed{};
+			size_t undispatched{};			// pending timers not yet posted to the pool
+			size_t dispatching{};			// posted and not yet finished
+			size_t waiters{};
+			bool stop{ false };
+			const clock::time_point start{ clock::now() };
+			const clock::duration resolution;
+			thread_pool *const pool;
+			std::thread thread;
+
+			uint64_t now_tick() const noexcept
+			{
+				return static_cast<uint64_t>((clock::now() - start) / resolution);
+			}
+
+			void insert(timer &t) noexcept
+			{
+				const auto delta = static_cast<int64_t>(t.expiry - tick);
+				if (delta < 0)
+					wheel[0][tick & slot_mask].push_back(&t);
+				else
+				{
+					auto expiry = delta > static_cast<int64_t>(max_delta) ? tick + max_delta : t.expiry;
+					unsigned level = 0;
+					while (level < levels - 1 && static_cast<uint64_t>(delta) >= uint64_t{ 1 } << (level_bits * (level + 1)))
+						++level;
+					wheel[level][(expiry >> (level_bits * level)) & slot_mask].push_back(&t);
+				}
+			}
+
+			void cascade(unsigned level, uint64_t index) noexcept
+			{
+				link list;
+				wheel[level][index].move_to(list);
+				while (!list.empty())
+				{
+					auto t = static_cast<timer *>(list.next);
+					t->unlink();
+					insert(*t);
+				}
+			}
+
+			void advance(uint64_t now) noexcept
+			{
+				while (tick <= now)
+				{
+					const auto index = tick & slot_mask;
+					for (unsigned level = 1; level < levels && 0 == ((tick >> (level_bits * (level - 1))) & slot_mask); ++level)
+						cascade(level, (tick >> (level_bits * level)) & slot_mask);
+
+					auto &slot = wheel[0][index];
+					while (!slot.empty())
+					{
+						auto t = static_cast<timer *>(slot.next);
+						t->unlink();
+						t->state = timer::state_t::pending;
+						pending.push_back(t);
+						++undispatched;
+						--armed;
+						add_metric(metric::timers_armed, -1);
+					}
+					++tick;
+				}
+			}
+
+			// first tick worth waking up for: a non-empty slot in the current round or the next cascade
+			uint64_t next_tick() const noexcept
+			{
+				const auto index = tick & slot_mask;
+				for (auto i = index; i < slots; ++i)
+					if (!wheel[0][i].empty())
+						return tick + (i - index);
+				return tick + (slots - index);
+			}
+
+			// a timer that has been cancelled or re-armed after it was posted leaves nothing to run
+			void run_pending() noexcept
+			{
+				std::unique_lock<std::mutex> l(lock);
+				if (!pending.empty())
+				{
+					auto t = static_cast<timer *>(pending.next);
+					t->unlink();
+					t->state = timer::state_t::idle;
+					running_entry entry{ t, std::this_thread::get_id(), running };
+					running = &entry;
+					if constexpr (metrics_enabled)
+					{
+						add_metric(metric::timers_fired);
+						record_latency(latency_metric::timer_lateness, clock::now() - (start + resolution * t->expiry));
+					}
+					auto callback = t->callback;
+					auto context = t->context;
+					l.unlock();
+					{
+						const watchdog_scope scope{ "timer", context };
+						callback(context);
+					}
+					l.lock();
+					// the timer itself may have been destroyed by its callback
+					for (auto p = &running; *p; p = &(*p)->next)
+					{
+						if (*p == &entry)
+						{
+							*p = entry.next;
+							break;
+						}
+					}
+				}
+				--dispatching;
+				if (waiters)
+					done.notify_all();
+			}
+
+			static detached_handoff dispatch(timer_wheel *self) noexcept
+			{
+				co_await self->pool->schedule();
+				self->run_pending();
+				co_return nullptr;
+			}
+
+			bool is_running_elsewhere(const timer &t) const noexcept
+			{
+				for (auto entry = running; entry; entry = entry->next)
+				{
+					if (entry->t == &t && entry->thread != std::this_thread::get_id())
+						return true;
+				}
+				return false;
+			}
+
+			void run() noexcept
+			{
+				std::unique_lock<std::mutex> l(lock);
+				while (!stop)
+				{
+					if (!armed)
+					{
+						sleeping_until = ~uint64_t{};
+						wake.wait(l);
+						continue;
+					}
+
+					const auto next = next_tick();
+					if (now_tick() < next)
+					{
+						sleeping_until = next;
+						wake.wait_until(l, start + resolution * next);
+						continue;
+					}
+
+					advance(now_tick());
+					if (const auto count = std::exchange(undispatched, 0))
+					{
+						dispatching += count;
+						l.unlock();
+						for (size_t i = 0; i < count; ++i)
+							dispatch(this);
+						l.lock();
+					}
+				}
+			}
+
+			void arm(timer &t, TimeSpan due)
+			{
+				const auto due_ticks = (std::chrono::duration_cast<clock::duration>(due) + resolution - clock::duration{ 1 }) / resolution;
+				const std::lock_guard<std::mutex> l(lock);
+				if (t.state == timer::state_t::armed)
+				{
+					--armed;
+					add_metric(metric::timers_armed, -1);
+				}
+				if (t.state != timer::state_t::idle)
+					t.unlink();
+
+				const auto now = now_tick();
+				if (!armed && tick < now)
+					tick = now;		// the wheel is empty and may be fast-forwarded
+				// the current tick is partially elapsed, so one more tick is needed to never fire early
+				t.expiry = now + 1 + static_cast<uint64_t>((std::max)(due_ticks, decltype(due_ticks){ 0 }));
+				insert(t);
+				t.state = timer::state_t::armed;
+				++armed;
+				add_metric(metric::timers_armed);
+				if (t.expiry < sleeping_until)
+				{
+					sleeping_until = t.expiry;
+					wake.notify_one();
+				}
+			}
+
+			bool cancel(timer &t) noexcept
+			{
+				std::unique_lock<std::mutex> l(lock);
+				switch (t.state)
+				{
+				case timer::state_t::armed:
+					--armed;
+					add_metric(metric::timers_armed, -1);
+					[[fallthrough]];
+				case timer::state_t::pending:
+					t.unlink();
+					t.state = timer::state_t::idle;
+					return true;
+				default:
+					if (is_running_elsewhere(t))
+					{
+						++waiters;
+						done.wait(l, [&] { return !is_running_elsewhere(t); });
+						--waiters;
+					}
+					return false;
+				}
+			}
+
+		public:
+			timer_wheel(const timer_wheel &) = delete;
+			timer_wheel &operator =(const timer_wheel &) = delete;
+
+			// the pool runs expired callbacks and must outlive the wheel
+			explicit timer_wheel(clock::duration resolution = std::chrono::milliseconds{ 1 }, thread_pool &pool = thread_pool::get_default()) :
+				resolution{ resolution },
+				pool{ &pool },
+				thread{ [this] { run(); } }
+			{}
+
+			// all timers must be disarmed before the wheel is destroyed
+			~timer_wheel()
+			{
+				{
+					const std::lock_guard<std::mutex> l(lock);
+					stop = true;
+					wake.notify_one();
+				}
+				thread.join();
+
+				std::unique_lock<std::mutex> l(lock);
+				++waiters;
+				done.wait(l, [this] { return !dispatching; });
+				--waiters;
+			}
+
+			static timer_wheel &get_default()
+			{
+				static timer_wheel instance;
+				return instance;
+			}
+		};
+
+#if defined(_WIN32) && !defined(CPPWINRT_EX_USE_TIMER_WHEEL)
+		// Thread pool timer with the same interface as timer_wheel::timer
+		// Used by default on Windows; define CPPWINRT_EX_USE_TIMER_WHEEL to share the timer wheel instead.
+		class threadpool_timer
+		{
+			struct timer_traits : winrt::impl::handle_traits<PTP_TIMER>
+			{
+				static void close(type value) noexcept
+				{
+					CloseThreadpoolTimer(value);
+				}
+			};
+
+			void (*callback)(void *) noexcept;
+			void *context;
+
+			winrt::impl::handle<timer_traits> timer
+			{
+				CreateThreadpoolTimer([](PTP_CALLBACK_INSTANCE, void * context, PTP_TIMER) noexcept
+				{
+					auto pthis = static_cast<threadpool_timer *>(context);
+					pthis->callback(pthis->context);
+				}, this, nullptr)
+			};
+
+		public:
+			threadpool_timer(void (*callback)(void *) noexcept, void *context) noexcept :
+				callback{ callback },
+				context{ context }
+			{}
+
+			void set(TimeSpan due) noexcept
+			{
+				int64_t relative_count = -due.count();
+				SetThreadpoolTimer(winrt::get_abi(timer), reinterpret_cast<PFILETIME>(&relative_count), 0, 0);
+			}
+
+			void cancel() noexcept
+			{
+				SetThreadpoolTimer(winrt::get_abi(timer), nullptr, 0, 0);
+				WaitForThreadpoolTimerCallbacks(winrt::get_abi(timer), TRUE);
+			}
+		};
+
+		using system_timer = threadpool_timer;
+#else
+		using system_timer = timer_wheel::timer;
+#endif
+
+		// awaitable that resumes the caller after a given time
+		// If a cancellation token is passed, cancellation resumes the caller immediately with hresult_canceled.
+		class resume_after
+		{
+			system_timer timer{ [](void *context) noexcept
+			{
+				static_cast<resume_after *>(context)->complete(false);
+			}, this };
+			cancellation_registration registration{ [](void *context) noexcept
+			{
+				static_cast<resume_after *>(context)->complete(true);
+			}, this };
+			TimeSpan duration;
+			cancellation_token token;
+			continuation resume_location;
+			completion_latch latch;
+			bool cancelled{ false };
+
+			void complete(bool cancelled_) noexcept
+			{
+				if (latch.try_claim())
+				{
+					trace(cancelled_ ? trace_event::timer_cancelled : trace_event::timer_fired, this);
+					cancelled = cancelled_;
+					if (latch.complete())
+						resume_location();
+				}
+			}
+
+		public:
+			resume_after(TimeSpan duration) noexcept :
+				duration{ duration }
+			{}
+
+			resume_after(TimeSpan duration, cancellation_token token) noexcept :
+				duration{ duration },
+				token{ std::move(token) }
+			{}
+
+			bool await_ready() noexcept
+			{
+				cancelled = token.is_cancellation_requested();
+				return cancelled || duration.count() <= 0;
+			}
+
+			bool await_suspend(coro::coroutine_handle<> handle)
+			{
+				return await_suspend(continuation{ handle });
+			}
+
+			bool await_suspend(continuation handle)
+			{
+				trace(trace_event::timer_armed, this, trace_duration(duration));
+				resume_location = handle;
+				registration.set(token);
+				timer.set(duration);
+				return latch.suspend();
+			}
+
+			// reports cancellation as a value
+			expected<void> try_resume() noexcept
+			{
+				registration.reset();
+				if (cancelled)
+				{
+					timer.cancel();
+					return canceled_error();
+				}
+				return {};
+			}
+
+			void await_resume()
+			{
+				if (!try_resume())
+					throw_canceled();
+			}
+		};
+
+		// Cancellable timer
+		class async_timer
+		{
+			system_timer timer{ [](void *context) noexcept
+			{
+				static_cast<async_timer *>(context)->complete(false);
+			}, this };
+			cancellation_registration registration{ [](void *context) noexcept
+			{
+				static_cast<async_timer *>(context)->complete(true);
+			}, this };
+
+			std::atomic<bool> cancelled{ false };
+			continuation resume_location;
+			completion_latch latch;
+			bool wait_cancelled{ false };
+
+			//
+			bool is_cancelled() const noexcept
+			{
+				return cancelled.load(std::memory_order_acquire);
+			}
+
+			// completes the current wait, if it has not been completed yet
+			void complete(bool cancelled_) noexcept
+			{
+				if (latch.try_claim())
+				{
+					trace(cancelled_ ? trace_event::timer_cancelled : trace_event::timer_fired, this);
+					wait_cancelled = cancelled_;
+					if (latch.complete())
+						resume_location();
+				}
+			}
+
+		public:
+			auto wait(TimeSpan duration, cancellation_token token = {}) noexcept
+			{
+				class awaiter
+				{
+					async_timer *timer;
+					TimeSpan duration;
+					cancellation_token token;
+
+				public:
+					awaiter(async_timer *timer, TimeSpan duration, cancellation_token &&token) noexcept :
+						timer{ timer },
+						duration{ duration },
+						token{ std::move(token) }
+					{}
+
+					bool await_ready() const noexcept
+					{
+						timer->wait_cancelled = timer->is_cancelled() || token.is_cancellation_requested();
+						return timer->wait_cancelled || duration.count() <= 0;
+					}
+
+					bool await_suspend(coro::coroutine_handle<> handle)
+					{
+						return await_suspend(continuation{ handle });
+					}
+
+					bool await_suspend(continuation handle)
+					{
+						trace(trace_event::timer_armed, timer, trace_duration(duration));
+						timer->resume_location = handle;
+						timer->registration.set(token);
+						timer->timer.set(duration);
+						if (timer->is_cancelled())
+							timer->complete(true);
+						return timer->latch.suspend();
+					}
+
+					// reports cancellation as a value
+					expected<void> try_resume() const noexcept
+					{
+						timer->registration.reset();
+						if (timer->wait_cancelled)
+						{
+							timer->timer.cancel();
+							return canceled_error();
+						}
+						return {};
+					}
+
+					void await_resume() const
+					{
+						if (!try_resume())
+							throw_canceled();
+					}
+				};
+
+				latch.reset();
+				return awaiter{ this, duration, std::move(token) };
+			}
+
+			// cancels the current and all future waits
+			void cancel()
+			{
+				cancelled.store(true, std::memory_order_release);
+				complete(true);
+			}
+		};
+
+		// resumeable I/O with timeout
+		template<class D>
+		class supports_timeout
+		{
+			system_timer m_timer{ [](void *context) noexcept
+			{
+				static_cast<D *>(context)->on_timeout();
+			}, static_cast<D *>(this) };
+			TimeSpan timeout;
+
+		protected:
+			using supports_timeout_base = supports_timeout;
+
+			supports_timeout(TimeSpan timeout) :
+				timeout{ timeout }
+			{}
+
+			supports_timeout(supports_timeout &&o) noexcept :
+				timeout{ o.timeout }
+			{}
+
+			void set_timer() noexcept
+			{
+				if (timeout.count())
+					m_timer.set(timeout);
+			}
+
+			void reset_timer() noexcept
+			{
+				if (timeout.count())
+					m_timer.cancel();
+			}
+		};
+
+#if defined(_WIN32)
+		class resumable_io_timeout
+		{
+			struct io_traits : winrt::impl::handle_traits<PTP_IO>
+			{
+				static void close(type value) noexcept
+				{
+					CloseThreadpoolIo(value);
+				}
+			};
+
+			class my_awaitable_base : public OVERLAPPED
+			{
+			protected:
+				uint32_t m_result{};
+				continuation m_resume;
+#if defined(CPPWINRT_EX_ENABLE_METRICS)
+				std::chrono::steady_clock::time_point submitted{};
+#endif
+				virtual void resume() = 0;
 
-					using index_t = std::make_index_sequence<sizeof...(Awaitables)>;
-					when_any_helper(std::move(references), std::move(awaitables_local_copy), index_t{});
-				}
+				my_awaitable_base() : OVERLAPPED{}
+				{}
 
-				size_t await_resume() const
+			public:
+				static void __stdcall callback(PTP_CALLBACK_INSTANCE, void *, void * overlapped, ULONG result, ULONG_PTR, PTP_IO) noexcept
 				{
-					if (ptr->exception)
-						std::rethrow_exception(ptr->exception);
-					else
-						return ptr->index;
+					auto context = static_cast<my_awaitable_base *>(static_cast<OVERLAPPED *>(overlapped));
+					trace(trace_event::io_completed, context, result);
+#if defined(CPPWINRT_EX_ENABLE_METRICS)
+					add_metric(metric::io_in_flight, -1);
+					add_metric(metric::io_completed);
+					record_latency(latency_metric::io, std::chrono::steady_clock::now() - context->submitted);
+#endif
+					context->m_result = result;
+					const watchdog_scope scope{ "io", context };
+					context->resume();
 				}
 			};
 
-			return when_any_awaitable{ std::forward<Awaitables>(awaitables)... };
-		}
-
-		//non-void case
-		template<class T, class Awaitable>
-		inline winrt::fire_and_forget when_any_helper_single_value(std::shared_ptr<when_any_block_value<T>> master, Awaitable task, size_t index) noexcept
-		{
-			try
-			{
-				master->finished(co_await task, index);
-			}
-			catch(...)
+			template<class F>
+			class awaitable : protected my_awaitable_base, protected F, protected supports_timeout<awaitable<F>>
 			{
-				master->finished_exception();
-			}
-		}
-
-		template<class T, size_t N, class Tuple, size_t...I>
-		inline void when_any_helper_value(std::array<std::shared_ptr<when_any_block_value<T>>, N> &&master, Tuple &&tuple, std::index_sequence<I...>) noexcept
-		{
-			[[maybe_unused]] auto x = { when_any_helper_single_value<T>(std::get<I>(std::move(master)), std::get<I>(std::move(tuple)), I)... };
-		}
+				PTP_IO m_io{ nullptr };
+				HANDLE object;
+				cancellation_token token;
+				std::atomic<bool> cancelled{ false };
+				std::atomic<bool> timed_out{ false };
+				completion_latch latch;
+				cancellation_registration registration{ [](void *context) noexcept
+				{
+					auto self = static_cast<awaitable *>(context);
+					self->cancelled.store(true, std::memory_order_release);
+					CancelIoEx(self->object, self);
+				}, this };
 
+				// the completion may arrive before await_suspend has returned, the coroutine then does not suspend
+				virtual void resume() override
+				{
+					reset_timer();
+					if (latch.try_claim() && latch.complete())
+						m_resume();
+				}
 
-		template<class T, class...Awaitables>
-		inline auto when_any_impl(result_type<T>, Awaitables &&...awaitables)
-		{
-			using value_type = std::decay_t<T>;
-			struct when_any_awaitable
-			{
-				std::shared_ptr<when_any_block_value<value_type>> ptr;
-				std::tuple<std::decay_t<Awaitables>...> awaitables;
+			public:
+				awaitable(PTP_IO io, HANDLE object, F &&callback, winrt::Windows::Foundation::TimeSpan timeout, cancellation_token &&token) noexcept :
+					m_io{ io },
+					object{ object },
+					F{ std::forward<F>(callback) },
+					supports_timeout_base{ timeout },
+					token{ std::move(token) }
+				{}
 
-				when_any_awaitable(Awaitables &&...awaitables) noexcept :
-					awaitables{ std::forward<Awaitables>(awaitables)... },
-					ptr{ std::make_shared<when_any_block_value<value_type>>() }
+				// awaitables are only moved before they are awaited
+				awaitable(awaitable &&o) :
+					m_io{ o.m_io },
+					object{ o.object },
+					F{ static_cast<F &&>(o) },
+					supports_timeout_base{ std::move(o) },
+					token{ std::move(o.token) }
 				{}
 
 				bool await_ready() const noexcept
@@ -825,344 +6947,801 @@ namespace winrt_ex
 					return false;
 				}
 
-				void await_suspend(std::experimental::coroutine_handle<> handle)
+				bool await_suspend(continuation resume_handle)
 				{
-					ptr->resume.store(handle, std::memory_order_relaxed);
-					std::array<std::shared_ptr<when_any_block_value<value_type>>, sizeof...(Awaitables)> references;
-					std::fill(references.begin(), references.end(), ptr);
+					m_resume = resume_handle;
+					registration.set(token);
+					if (cancelled.load(std::memory_order_acquire))
+					{
+						m_result = ERROR_OPERATION_ABORTED;
+						return false;
+					}
+
+					// the timer is armed before the operation is started, so the completion never races with arming it
+					set_timer();
+					trace(trace_event::io_submitted, static_cast<my_awaitable_base *>(this));
+#if defined(CPPWINRT_EX_ENABLE_METRICS)
+					add_metric(metric::io_in_flight);
+					this->submitted = std::chrono::steady_clock::now();
+#endif
+					StartThreadpoolIo(m_io);
+
+					try
+					{
+						if constexpr (std::is_same_v<void, decltype((*this)(std::declval<OVERLAPPED &>()))>)
+							(*this)(*this);
+						else if (!(*this)(*this))
+						{
+							CancelThreadpoolIo(m_io);
+							add_metric(metric::io_in_flight, -1);
+							reset_timer();
+							return false;
+						}
+					}
+					catch (...)
+					{
+						CancelThreadpoolIo(m_io);
+						add_metric(metric::io_in_flight, -1);
+						reset_timer();
+						throw;
+					}
 
-					auto awaitables_copy = std::move(awaitables);
-					using index_t = std::make_index_sequence<sizeof...(Awaitables)>;
-					when_any_helper_value(std::move(references), std::move(awaitables_copy), index_t{});
+					// cancellation or timeout while the operation was being started; the latch keeps this awaitable alive
+					// until suspend() even if the operation has already completed
+					if (cancelled.load(std::memory_order_acquire) || timed_out.load(std::memory_order_acquire))
+						CancelIoEx(object, this);
+					return latch.suspend();
 				}
 
-				std::pair<T, size_t> await_resume() const
+				bool await_suspend(coro::coroutine_handle<> resume_handle)
 				{
-					if (ptr->exception)
-						std::rethrow_exception(ptr->exception);
-					else
-						return { std::move(ptr->result), ptr->index };
+					return await_suspend(continuation{ resume_handle });
+				}
+
+				// reports cancellation, timeout and I/O errors as values
+				expected<uint32_t> try_resume() noexcept
+				{
+					registration.reset();
+					if (m_result != NO_ERROR && m_result != ERROR_HANDLE_EOF)
+					{
+						if (m_result == ERROR_OPERATION_ABORTED)
+						{
+							if (cancelled.load(std::memory_order_acquire))
+								return canceled_error();
+							add_metric(metric::io_timed_out);
+							m_result = ERROR_TIMEOUT;
+						}
+						return std::error_code(static_cast<int>(m_result), std::system_category());
+					}
+
+					return static_cast<uint32_t>(InternalHigh);
+				}
+
+				uint32_t await_resume()
+				{
+					auto result = try_resume();
+					if (!result)
+					{
+						if (result.error() == canceled_error())
+							throw_canceled();
+						throw hresult_error(HRESULT_FROM_WIN32(result.error().value()));
+					}
+					return *result;
+				}
+
+				void on_timeout()
+				{
+					// cancel io; await_suspend cancels it again if the timer expired before the operation was started
+					timed_out.store(true, std::memory_order_release);
+					CancelIoEx(object, this);
 				}
 			};
 
-			return when_any_awaitable{ std::forward<Awaitables>(awaitables)... };
-		}
+			winrt::impl::handle<io_traits> m_io;
+			HANDLE object;
 
-		template<class...Ts>
-		struct are_all_same
-		{
-			using first_type = get_first_t<Ts...>;
+			//
+		public:
+			resumable_io_timeout(HANDLE object) :
+				object{ object },
+				m_io{ CreateThreadpoolIo(object, my_awaitable_base::callback, nullptr, nullptr) }
+			{
+				if (!m_io)
+				{
+					winrt::throw_last_error();
+				}
+			}
 
-			using type = std::conjunction<std::is_same<first_type, Ts>...>;
+			template <typename F>
+			auto start(F &&callback, winrt::Windows::Foundation::TimeSpan timeout, cancellation_token token = {})
+			{
+				return awaitable<F>{get(), object, std::forward<F>(callback), timeout, std::move(token)};
+			}
+
+			PTP_IO get() const noexcept
+			{
+				return winrt::get_abi(m_io);
+			}
 		};
+#elif defined(__linux__)
+		// io_uring instance with a dedicated completion thread
+		// Operations may be submitted from any thread, completions are dispatched on the completion thread.
+		class io_ring
+		{
+		public:
+			// operation submitted to the ring
+			struct completion
+			{
+#if defined(CPPWINRT_EX_ENABLE_METRICS)
+				std::chrono::steady_clock::time_point submitted{};
+#endif
+				virtual void complete(int result) noexcept = 0;
+			};
 
-		template<class...Ts>
-		using are_all_same_t = typename are_all_same<Ts...>::type;
+			// result of a batched submission: entries before submitted are in flight, the others have failed with error
+			struct batch_result
+			{
+				size_t submitted;
+				int error;
+			};
 
-		template<class...Ts>
-		constexpr bool are_all_same_v = typename are_all_same<Ts...>::type::value;
+		private:
+			static constexpr uint64_t stop_marker = ~uint64_t{};
+			// attempts to submit while the completion queue is full or the kernel is short of memory
+			static constexpr unsigned submit_retries = 1000;
+
+			int fd{ -1 };
+			void *sq_ptr{ MAP_FAILED };
+			void *cq_ptr{ MAP_FAILED };
+			size_t sq_size{};
+			size_t cq_size{};
+			io_uring_sqe *sqes{ static_cast<io_uring_sqe *>(MAP_FAILED) };
+			size_t sqes_size{};
+
+			unsigned *sq_head{};
+			unsigned *sq_tail{};
+			unsigned *sq_mask{};
+			unsigned *sq_entries{};
+			unsigned *sq_array{};
+			unsigned *cq_head{};
+			unsigned *cq_tail{};
+			unsigned *cq_mask{};
+			io_uring_cqe *cqes{};
+
+			srwlock sq_lock;
+			std::thread completion_thread;
+			// error that stopped the completion thread from waiting; the ring then refuses new operations
+			std::atomic<int> failure{ 0 };
+			std::atomic<bool> stopping{ false };
+
+			[[noreturn]] static void throw_errno(int error = errno)
+			{
+				throw std::system_error(error, std::system_category());
+			}
 
-		template<class...Awaitables>
-		inline auto when_any(Awaitables &&...awaitables)
-		{
-			static_assert(sizeof...(Awaitables) >= 2, "when_any must be passed at least two arguments");
-			static_assert(are_all_same_v<decltype(get_result_type(awaitables))...>, "when_any requires all awaitables to produce the same type");
+			int enter(unsigned to_submit, unsigned min_complete, unsigned flags) noexcept
+			{
+				return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+			}
 
-			return when_any_impl(get_first_result_type(awaitables...), std::forward<Awaitables>(awaitables)...);
-		}
+			void close() noexcept
+			{
+				if (sqes != MAP_FAILED)
+					munmap(sqes, sqes_size);
+				if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr)
+					munmap(cq_ptr, cq_size);
+				if (sq_ptr != MAP_FAILED)
+					munmap(sq_ptr, sq_size);
+				if (fd >= 0)
+					::close(fd);
+			}
 
-		//////////////////////////////
-		// Simplified versions of IAsyncAction and IAsyncOperation that do not force return to original thread context
-		template <typename Async>
-		struct await_adapter
-		{
-			const Async & async;
+			void setup(unsigned entries)
+			{
+				io_uring_params params{};
+				fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+				if (fd < 0)
+					throw_errno();
+
+				const bool single_mmap = 0 != (params.features & IORING_FEAT_SINGLE_MMAP);
+				sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+				cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+				if (single_mmap)
+					sq_size = cq_size = (std::max)(sq_size, cq_size);
+
+				sq_ptr = mmap(nullptr, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+				if (sq_ptr == MAP_FAILED)
+					throw_errno();
+				cq_ptr = single_mmap ? sq_ptr : mmap(nullptr, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+				if (cq_ptr == MAP_FAILED)
+					throw_errno();
+				sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+				sqes = static_cast<io_uring_sqe *>(mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+				if (sqes == MAP_FAILED)
+					throw_errno();
+
+				auto sq = static_cast<char *>(sq_ptr);
+				sq_head = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+				sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+				sq_mask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+				sq_entries = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_entries);
+				sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+
+				auto cq = static_cast<char *>(cq_ptr);
+				cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+				cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+				cq_mask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+				cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+			}
 
-			bool await_ready() const
+			// must be called with sq_lock held
+			io_uring_sqe &next_sqe(unsigned &tail) noexcept
 			{
-				return async.Status() == winrt::Windows::Foundation::AsyncStatus::Completed;
+				const auto index = tail++ & *sq_mask;
+				sq_array[index] = index;
+				return sqes[index];
 			}
 
-			void await_suspend(std::experimental::coroutine_handle<> handle) const
+			// write the operation and its linked timeout, returns the number of entries used; must be called with sq_lock held
+			unsigned prepare(unsigned &tail, const io_uring_sqe &prepared, completion *target, const __kernel_timespec *timeout) noexcept
 			{
-				async.Completed([handle](const auto &, winrt::Windows::Foundation::AsyncStatus)
-				{
-					handle();
-				});
+				trace(trace_event::io_submitted, target, prepared.opcode);
+#if defined(CPPWINRT_EX_ENABLE_METRICS)
+				add_metric(metric::io_in_flight);
+				target->submitted = std::chrono::steady_clock::now();
+#endif
+				auto &sqe = next_sqe(tail);
+				sqe = prepared;
+				sqe.user_data = reinterpret_cast<uintptr_t>(target);
+				if (!timeout)
+					return 1;
+
+				sqe.flags |= IOSQE_IO_LINK;
+
+				auto &timeout_sqe = next_sqe(tail);
+				std::memset(&timeout_sqe, 0, sizeof(timeout_sqe));
+				timeout_sqe.opcode = IORING_OP_LINK_TIMEOUT;
+				timeout_sqe.fd = -1;
+				timeout_sqe.addr = reinterpret_cast<uintptr_t>(timeout);
+				timeout_sqe.len = 1;
+				timeout_sqe.user_data = 0;
+				return 2;
 			}
 
-			auto await_resume() const
+			// an operation that has been prepared but not accepted by the kernel
+			static void withdraw(completion *target, int error) noexcept
 			{
-				return async.GetResults();
+				trace(trace_event::io_completed, target, static_cast<uint32_t>(-error));
+			#if defined(CPPWINRT_EX_ENABLE_METRICS)
+				add_metric(metric::io_in_flight, -1);
+			#else
+				(void)target;
+			#endif
 			}
-		};
 
-		// start & start_async
-		// methods "starts" an asynchronous operation that only starts in await_suspend
-		struct default_policy
-		{
-			template<class T>
-			struct promise
+			// Publish entries up to tail and submit them, must be called with sq_lock held. Returns the position of the first
+			// entry the kernel has not accepted, which is tail on success, and sets error. Entries that are not accepted are
+			// withdrawn by moving the tail back: the kernel only reads the queue in io_uring_enter with entries to submit, which
+			// is only called under sq_lock, so no entry refers to an operation once its failure has been reported.
+			unsigned flush(unsigned tail, int &error) noexcept
 			{
-				template<class Awaitable>
-				static ::winrt::Windows::Foundation::IAsyncOperation<T> start(Awaitable awaitable)
+				std::atomic_ref<unsigned> published{ *sq_tail };
+				published.store(tail, std::memory_order_release);
+				for (unsigned retries = 0;;)
 				{
-					auto result = co_await awaitable;
-					co_return result;
+					const auto head = std::atomic_ref<unsigned>{ *sq_head }.load(std::memory_order_acquire);
+					error = 0;
+					if (head == tail)
+						return tail;
+					const auto submitted = enter(tail - head, 0, 0);
+					if (submitted > 0)
+						continue;
+					error = submitted < 0 ? errno : EAGAIN;
+					if (error == EINTR)
+						continue;
+					// the completion queue is full or the kernel is short of memory: let the completion thread reap completions
+					if ((error == EAGAIN || error == EBUSY) && ++retries < submit_retries)
+					{
+						std::this_thread::sleep_for(std::chrono::microseconds{ 100 });
+						continue;
+					}
+					published.store(head, std::memory_order_release);
+					return head;
 				}
+			}
 
-				static ::winrt::Windows::Foundation::IAsyncOperation<T> wait(winrt::Windows::Foundation::TimeSpan timeout)
+			void run() noexcept
+			{
+				bool stop = false;
+				while (!stop)
 				{
-					co_await ::winrt::resume_after{ timeout };
-					throw ::winrt::hresult_canceled{};
+					if (enter(0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+					{
+						// the ring can no longer wait for completions: refuse new operations and keep polling for the completions
+						// of operations in flight, which the kernel still posts, until the ring is destroyed
+						int expected = 0;
+						failure.compare_exchange_strong(expected, errno, std::memory_order_release, std::memory_order_relaxed);
+						stop = stopping.load(std::memory_order_acquire);
+						std::this_thread::sleep_for(std::chrono::milliseconds{ 1 });
+					}
+
+					auto head = std::atomic_ref<unsigned>{ *cq_head }.load(std::memory_order_relaxed);
+					const auto tail = std::atomic_ref<unsigned>{ *cq_tail }.load(std::memory_order_acquire);
+					while (head != tail)
+					{
+						const auto &cqe = cqes[head & *cq_mask];
+						const auto user_data = cqe.user_data;
+						const auto result = cqe.res;
+						std::atomic_ref<unsigned>{ *cq_head }.store(++head, std::memory_order_release);
+
+						if (user_data == stop_marker)
+							stop = true;
+						else if (user_data)
+						{
+							const auto target = reinterpret_cast<completion *>(static_cast<uintptr_t>(user_data));
+							trace(trace_event::io_completed, target, static_cast<uint32_t>(result));
+#if defined(CPPWINRT_EX_ENABLE_METRICS)
+							add_metric(metric::io_in_flight, -1);
+							add_metric(metric::io_completed);
+							record_latency(latency_metric::io, std::chrono::steady_clock::now() - target->submitted);
+#endif
+							const watchdog_scope scope{ "io", target };
+							target->complete(result);
+						}
+					}
 				}
-			};
+			}
+
+		public:
+			io_ring(const io_ring &) = delete;
+			io_ring &operator =(const io_ring &) = delete;
 
-			template<>
-			struct promise<void>
+			explicit io_ring(unsigned entries = 256)
 			{
-				template<class Awaitable>
-				static ::winrt::Windows::Foundation::IAsyncAction start(Awaitable awaitable)
+				try
 				{
-					co_await awaitable;
+					setup(entries);
+					completion_thread = std::thread{ [this] { run(); } };
 				}
-
-				static ::winrt::Windows::Foundation::IAsyncAction wait(::winrt::Windows::Foundation::TimeSpan timeout)
+				catch (...)
 				{
-					co_await ::winrt::resume_after{ timeout };
-					throw ::winrt::hresult_canceled{};
+					close();
+					throw;
 				}
-			};
-		};
+			}
 
-		struct ex_policy
-		{
-			template<class T>
-			struct promise
+			// all operations must be completed before the ring is destroyed
+			~io_ring()
 			{
-				template<class Awaitable>
-				static future<T> start(Awaitable awaitable)
+				if (completion_thread.joinable())
 				{
-					co_return co_await awaitable;
+					// a failed completion thread notices stopping, otherwise the stop marker wakes it
+					stopping.store(true, std::memory_order_release);
+					for (int error = EAGAIN; error && !failure.load(std::memory_order_acquire);)
+					{
+						const std::lock_guard<srwlock> l(sq_lock);
+						auto tail = *sq_tail;
+						auto &sqe = next_sqe(tail);
+						std::memset(&sqe, 0, sizeof(sqe));
+						sqe.opcode = IORING_OP_NOP;
+						sqe.user_data = stop_marker;
+						flush(tail, error);
+					}
+					completion_thread.join();
 				}
+				close();
+			}
+
+			static io_ring &get_default()
+			{
+				static io_ring instance;
+				return instance;
+			}
+
+			int get() const noexcept
+			{
+				return fd;
+			}
+
+			// Submit a prepared operation. If timeout is not null, the operation is linked with IORING_OP_LINK_TIMEOUT and is
+			// cancelled by the kernel when the timeout expires: it then completes with -ECANCELED.
+			// Returns 0 once the operation has been submitted. Otherwise it is never completed and the error is returned:
+			// ECANCELED if cancelled is not null and is set, or the error of a ring that has failed or of io_uring_enter.
+			// cancelled is checked under the same lock as cancel() submissions, so an operation is either not submitted or
+			// cancelled after submission.
+			int submit(const io_uring_sqe &prepared, completion *target, const __kernel_timespec *timeout, const std::atomic<bool> *cancelled = nullptr)
+			{
+				const std::lock_guard<srwlock> l(sq_lock);
+				if (const auto error = failure.load(std::memory_order_acquire))
+					return error;
+				if (cancelled && cancelled->load(std::memory_order_acquire))
+					return ECANCELED;
+
+				const auto first = *sq_tail;
+				auto tail = first;
+				prepare(tail, prepared, target, timeout);
+				int error;
+				// a linked timeout that has not been accepted only leaves the operation without its timeout
+				if (flush(tail, error) != first)
+					return 0;
+				withdraw(target, error);
+				return error;
+			}
+
+			// operation of a batched submission
+			struct batch_entry : completion
+			{
+				io_uring_sqe sqe{};
+				__kernel_timespec timeout{};
+				bool has_timeout{ false };
 			};
 
-			template<>
-			struct promise<void>
+			// Submit several operations with a single io_uring_enter. Batches that do not fit into the submission queue are
+			// submitted in chunks. Cancellation is checked once for the whole batch, as in submit(). If a chunk is not accepted,
+			// the entries from the first one that has not been submitted on are never completed and the error is returned.
+			template<class Entry>
+			batch_result submit(Entry *entries, size_t count, const std::atomic<bool> *cancelled = nullptr)
 			{
-				template<class Awaitable>
-				static future<void> start(Awaitable awaitable)
+				static_assert(std::is_base_of_v<batch_entry, Entry>, "batch entries must derive from io_ring::batch_entry");
+				const std::lock_guard<srwlock> l(sq_lock);
+				if (const auto error = failure.load(std::memory_order_acquire))
+					return { 0, error };
+				if (cancelled && cancelled->load(std::memory_order_acquire))
+					return { 0, ECANCELED };
+
+				batch_result result{ 0, 0 };
+				auto start = *sq_tail;
+				auto tail = start;
+				size_t prepared = 0;
+				// submits the prepared chunk, false if some of its entries have not been accepted
+				const auto flush_chunk = [&]() noexcept
 				{
-					co_await awaitable;
+					const auto head = flush(tail, result.error);
+					for (auto position = start; result.submitted < prepared && position - start < head - start; ++result.submitted)
+						position += entries[result.submitted].has_timeout ? 2 : 1;
+					for (auto i = result.submitted; i < prepared; ++i)
+						withdraw(&entries[i], result.error);
+					start = tail;
+					return !result.error;
+				};
+
+				for (; prepared < count; ++prepared)
+				{
+					if (tail - start + 2 > *sq_entries && !flush_chunk())
+						return result;
+					batch_entry &entry = entries[prepared];
+					prepare(tail, entry.sqe, &entry, entry.has_timeout ? &entry.timeout : nullptr);
 				}
-			};
+				if (tail != start)
+					flush_chunk();
+				return result;
+			}
+
+			// Register fixed buffers with the kernel for IORING_OP_READ_FIXED/IORING_OP_WRITE_FIXED. A ring has a single set
+			// of registered buffers.
+			void register_buffers(const iovec *buffers, unsigned count)
+			{
+				if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, buffers, count) < 0)
+					throw_errno();
+			}
+
+			void unregister_buffers() noexcept
+			{
+				syscall(__NR_io_uring_register, fd, IORING_UNREGISTER_BUFFERS, nullptr, 0);
+			}
+
+			// Cancel an operation submitted for target. It completes with -ECANCELED unless it has already completed.
+			void cancel(completion *target)
+			{
+				const std::lock_guard<srwlock> l(sq_lock);
+				auto tail = *sq_tail;
+				auto &sqe = next_sqe(tail);
+				std::memset(&sqe, 0, sizeof(sqe));
+				sqe.opcode = IORING_OP_ASYNC_CANCEL;
+				sqe.fd = -1;
+				sqe.addr = reinterpret_cast<uintptr_t>(target);
+				sqe.user_data = 0;
+				int error;
+				if (flush(tail, error) != tail)
+					throw_errno(error);
+			}
 		};
 
-		template<class Policy,class Awaitable>
-		inline auto start(Awaitable &&awaitable)
-		{
-			using promise_wrapper_t = typename Policy::promise<decltype(std::declval<Awaitable &>().await_resume())>;
-			return promise_wrapper_t::start(std::forward<Awaitable>(awaitable));
-		}
+		class buffer_pool;
 
-		template<class Awaitable>
-		inline auto start(const Awaitable &awaitable)
+		// Exclusive use of one buffer of a buffer_pool
+		// The lease returns the buffer to the pool when it is destroyed. size() is the number of valid bytes, for example
+		// the number of bytes read into the buffer.
+		class buffer_lease
 		{
-			return start<default_policy>(awaitable);
-		}
+			friend class buffer_pool;
 
-		template<class Awaitable>
-		inline auto start_async(const Awaitable &awaitable)
-		{
-			return start<ex_policy>(awaitable);
-		}
+			buffer_pool *pool{};
+			uint32_t buffer_index{};
+			uint32_t length{};
 
-		// Cancellable timer
-		class async_timer
-		{
-			struct timer_traits : winrt::impl::handle_traits<PTP_TIMER>
+			buffer_lease(buffer_pool *pool, uint32_t index) noexcept :
+				pool{ pool },
+				buffer_index{ index }
+			{}
+
+		public:
+			buffer_lease() noexcept = default;
+
+			buffer_lease(buffer_lease &&o) noexcept :
+				pool{ std::exchange(o.pool, nullptr) },
+				buffer_index{ o.buffer_index },
+				length{ o.length }
+			{}
+
+			buffer_lease &operator =(buffer_lease &&o) noexcept
 			{
-				static void close(type value) noexcept
+				if (this != &o)
 				{
-					CloseThreadpoolTimer(value);
+					reset();
+					pool = std::exchange(o.pool, nullptr);
+					buffer_index = o.buffer_index;
+					length = o.length;
 				}
-			};
+				return *this;
+			}
 
-			winrt::impl::handle<timer_traits> timer
-			{ 
-				CreateThreadpoolTimer([](PTP_CALLBACK_INSTANCE, void * context, PTP_TIMER) noexcept
-				{
-					static_cast<async_timer *>(context)->resume();
-				}, this, nullptr) 
-			};
+			~buffer_lease()
+			{
+				reset();
+			}
+
+			explicit operator bool() const noexcept
+			{
+				return pool != nullptr;
+			}
 
-			std::atomic_flag resumed{ false };
-			std::atomic<bool> cancelled{ false };
-			std::experimental::coroutine_handle<> resume_location{ nullptr };
+			inline std::byte *data() const noexcept;
+			inline size_t capacity() const noexcept;
 
-			//
-			auto get() const noexcept
+			size_t size() const noexcept
 			{
-				return winrt::get_abi(timer);
+				return length;
 			}
 
-			bool is_cancelled() const noexcept
+			void resize(size_t size) noexcept
 			{
-				return cancelled.load(std::memory_order_acquire);
+				assert(size <= capacity());
+				length = static_cast<uint32_t>(size);
 			}
 
-			void resume() noexcept
+			std::byte *begin() const noexcept
 			{
-				if (resume_location && !resumed.test_and_set())
-					resume_location();
+				return data();
 			}
 
-			void set_handle(std::experimental::coroutine_handle<> handle)
+			std::byte *end() const noexcept
 			{
-				resume_location = handle;
+				return data() + length;
 			}
 
-		public:
-			auto wait(winrt::Windows::Foundation::TimeSpan duration) noexcept
+			// index of the buffer in the ring's registration, for IORING_OP_READ_FIXED and IORING_OP_WRITE_FIXED
+			unsigned index() const noexcept
 			{
-				class awaiter
-				{
-					async_timer *timer;
-					winrt::Windows::Foundation::TimeSpan duration;
+				return buffer_index;
+			}
 
-				public:
-					awaiter(async_timer *timer, winrt::Windows::Foundation::TimeSpan duration) noexcept :
-						timer{ timer },
-						duration{ duration }
-					{}
+			// returns the buffer to the pool
+			inline void reset() noexcept;
+		};
 
-					bool await_ready() const noexcept
-					{
-						return duration.count() <= 0;
-					}
+		// Pool of page-aligned buffers registered with the kernel once
+		// Fixed-buffer operations skip pinning and unpinning of user memory on every request. Buffers are acquired and
+		// returned through a lock-free stack, so the hot path neither allocates nor takes a lock. A ring holds a single
+		// registration, so there may be only one pool per io_ring. The pool must outlive its leases and pending reads.
+		class buffer_pool
+		{
+			friend class buffer_lease;
 
-					void await_suspend(std::experimental::coroutine_handle<> handle) noexcept
-					{
-						timer->set_handle(handle);
-						int64_t relative_count = -duration.count();
-						SetThreadpoolTimer(timer->get(), reinterpret_cast<PFILETIME>(&relative_count), 0, 0);
-					}
+			static constexpr uint32_t empty = ~uint32_t{};
 
-					void await_resume() const
-					{
-						timer->set_handle(nullptr);
-						if (timer->is_cancelled())
-							throw winrt::hresult_canceled();
-					}
-				};
+			io_ring *m_ring;
+			size_t m_buffer_size;
+			uint32_t m_count;
+			size_t mapping_size;
+			std::byte *memory{};
+			std::unique_ptr<std::atomic<uint32_t>[]> next;
+			// free stack head: version in the upper half against ABA, buffer index in the lower half
+			std::atomic<uint64_t> head;
 
-				resumed.clear();
-				return awaiter{ this,duration };
+			static size_t page_size() noexcept
+			{
+				return static_cast<size_t>(sysconf(_SC_PAGESIZE));
 			}
 
-			void cancel()
+			void release(uint32_t index) noexcept
 			{
-				cancelled.store(true, std::memory_order_release);
-				SetThreadpoolTimer(get(), nullptr, 0, 0);
-				WaitForThreadpoolTimerCallbacks(get(), TRUE);
-				resume();
+				auto h = head.load(std::memory_order_relaxed);
+				do
+				{
+					next[index].store(static_cast<uint32_t>(h), std::memory_order_relaxed);
+				} while (!head.compare_exchange_weak(h, ((h >> 32) + 1) << 32 | index, std::memory_order_release, std::memory_order_relaxed));
 			}
-		};
 
-		// resumeable I/O with timeout
-		template<class D>
-		class supports_timeout
-		{
-			struct timer_traits : winrt::impl::handle_traits<PTP_TIMER>
+		public:
+			buffer_pool(const buffer_pool &) = delete;
+			buffer_pool &operator =(const buffer_pool &) = delete;
+
+			// buffer_size is rounded up to a multiple of the page size
+			buffer_pool(size_t buffer_size, uint32_t count, io_ring &ring = io_ring::get_default()) :
+				m_ring{ &ring },
+				m_buffer_size{ (buffer_size + page_size() - 1) / page_size() * page_size() },
+				m_count{ count },
+				mapping_size{ m_buffer_size * count },
+				next{ std::make_unique<std::atomic<uint32_t>[]>(count) },
+				head{ 0 }
 			{
-				static void close(type value) noexcept
+				assert(count && count < empty && m_buffer_size <= ~uint32_t{});
+				auto mapping = mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+				if (mapping == MAP_FAILED)
+					throw std::system_error(errno, std::system_category());
+				memory = static_cast<std::byte *>(mapping);
+
+				std::vector<iovec> buffers(count);
+				for (uint32_t i = 0; i < count; ++i)
 				{
-					CloseThreadpoolTimer(value);
+					buffers[i].iov_base = memory + i * m_buffer_size;
+					buffers[i].iov_len = m_buffer_size;
+					next[i].store(i + 1 < count ? i + 1 : empty, std::memory_order_relaxed);
 				}
-			};
 
-			winrt::impl::handle<timer_traits> m_timer
-			{ 
-				CreateThreadpoolTimer([](PTP_CALLBACK_INSTANCE, void * context, PTP_TIMER) noexcept
+				try
 				{
-					static_cast<D *>(context)->on_timeout();
-				}, static_cast<D *>(this), nullptr)
-			};
-			winrt::Windows::Foundation::TimeSpan timeout;
-
-		protected:
-			using supports_timeout_base = supports_timeout;
+					m_ring->register_buffers(buffers.data(), count);
+				}
+				catch (...)
+				{
+					munmap(memory, mapping_size);
+					throw;
+				}
+			}
 
-			supports_timeout(winrt::Windows::Foundation::TimeSpan timeout) :
-				timeout{ timeout }
-			{}
+			~buffer_pool()
+			{
+				m_ring->unregister_buffers();
+				munmap(memory, mapping_size);
+			}
 
-			void set_timer() const noexcept
+			// returns an empty lease if all buffers are in use
+			buffer_lease try_acquire() noexcept
 			{
-				if (timeout.count())
+				auto h = head.load(std::memory_order_acquire);
+				for (;;)
 				{
-					int64_t relative_count = -timeout.count();
-					SetThreadpoolTimer(winrt::get_abi(m_timer), reinterpret_cast<PFILETIME>(&relative_count), 0, 0);
+					const auto index = static_cast<uint32_t>(h);
+					if (index == empty)
+						return {};
+					const auto n = next[index].load(std::memory_order_relaxed);
+					if (head.compare_exchange_weak(h, ((h >> 32) + 1) << 32 | n, std::memory_order_acquire, std::memory_order_acquire))
+						return { this, index };
 				}
 			}
 
-			void reset_timer() const noexcept
+			size_t buffer_size() const noexcept
 			{
-				if (timeout.count())
-				{
-					SetThreadpoolTimer(winrt::get_abi(m_timer), nullptr, 0, 0);
-					WaitForThreadpoolTimerCallbacks(winrt::get_abi(m_timer), TRUE);
-				}
+				return m_buffer_size;
+			}
+
+			uint32_t size() const noexcept
+			{
+				return m_count;
+			}
+
+			io_ring &ring() const noexcept
+			{
+				return *m_ring;
 			}
 		};
 
+		inline std::byte *buffer_lease::data() const noexcept
+		{
+			return pool->memory + buffer_index * pool->m_buffer_size;
+		}
+
+		inline size_t buffer_lease::capacity() const noexcept
+		{
+			return pool->m_buffer_size;
+		}
+
+		inline void buffer_lease::reset() noexcept
+		{
+			if (pool)
+				std::exchange(pool, nullptr)->release(buffer_index);
+			length = 0;
+		}
+
+		// resumable I/O with timeout on top of io_uring
+		// The callback receives io_uring_sqe with fd already set and fills in the operation. The timeout is armed by the kernel
+		// as a linked timeout in the same submission, so it costs neither an additional system call nor a timer thread.
 		class resumable_io_timeout
 		{
-			struct io_traits : winrt::impl::handle_traits<PTP_IO>
+			friend class io_batch;
+
+			static __kernel_timespec to_timespec(TimeSpan timeout) noexcept
 			{
-				static void close(type value) noexcept
+				const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count();
+				__kernel_timespec result{};
+				result.tv_sec = ns / 1'000'000'000;
+				result.tv_nsec = ns % 1'000'000'000;
+				return result;
+			}
+
+			// a kernel-cancelled operation was either cancelled by its token or timed out by its linked timeout
+			static expected<uint32_t> to_expected(int result, bool cancelled, bool timed) noexcept
+			{
+				if (result >= 0)
+					return static_cast<uint32_t>(result);
+				if (result == -ECANCELED)
 				{
-					CloseThreadpoolIo(value);
+					if (cancelled)
+						return canceled_error();
+					if (timed)
+					{
+						add_metric(metric::io_timed_out);
+						result = -ETIMEDOUT;
+					}
 				}
-			};
+				return std::error_code(-result, std::system_category());
+			}
 
-			class my_awaitable_base : public OVERLAPPED
+			class my_awaitable_base : public io_ring::completion
 			{
 			protected:
-				uint32_t m_result{};
-				std::experimental::coroutine_handle<> m_resume{ nullptr };
-				virtual void resume() = 0;
-
-				my_awaitable_base() : OVERLAPPED{}
-				{}
+				int m_result{};
+				continuation m_resume;
 
-			public:
-				static void __stdcall callback(PTP_CALLBACK_INSTANCE, void *, void * overlapped, ULONG result, ULONG_PTR, PTP_IO) noexcept
+				virtual void complete(int result) noexcept override
 				{
-					auto context = static_cast<my_awaitable_base *>(static_cast<OVERLAPPED *>(overlapped));
-					context->m_result = result;
-					context->resume();
+					m_result = result;
+					m_resume();
 				}
 			};
 
 			template<class F>
-			class awaitable : protected my_awaitable_base, protected F, protected supports_timeout<awaitable<F>>
+			class awaitable : protected my_awaitable_base, protected F
 			{
-				PTP_IO m_io{ nullptr };
-				HANDLE object;
-
-				virtual void resume() override
+				io_ring *m_ring;
+				int object;
+				TimeSpan timeout;
+				io_uring_sqe m_sqe{};
+				__kernel_timespec m_timeout{};
+				cancellation_token token;
+				std::atomic<bool> cancelled{ false };
+				cancellation_registration registration{ [](void *context) noexcept
 				{
-					reset_timer();
-					m_resume();
-				}
+					auto self = static_cast<awaitable *>(context);
+					self->cancelled.store(true, std::memory_order_release);
+					try
+					{
+						self->m_ring->cancel(self);
+					}
+					catch (...)
+					{
+					}
+				}, this };
 
 			public:
-				awaitable(PTP_IO io, HANDLE object, F &&callback, winrt::Windows::Foundation::TimeSpan timeout) noexcept :
-					m_io{ io },
+				template<class C>
+				awaitable(io_ring &ring, int object, C &&callback, TimeSpan timeout, cancellation_token &&token) :
+					F{ std::forward<C>(callback) },
+					m_ring{ &ring },
 					object{ object },
-					F{ std::forward<F>(callback) },
-					supports_timeout_base{ timeout }
+					timeout{ timeout },
+					token{ std::move(token) }
+				{}
+
+				// awaitables are only moved before they are awaited
+				awaitable(awaitable &&o) :
+					F{ static_cast<F &&>(o) },
+					m_ring{ o.m_ring },
+					object{ o.object },
+					timeout{ o.timeout },
+					token{ std::move(o.token) }
 				{}
 
 				bool await_ready() const noexcept
@@ -1170,101 +7749,358 @@ namespace winrt_ex
 					return false;
 				}
 
-				auto await_suspend(std::experimental::coroutine_handle<> resume_handle)
+				bool await_suspend(continuation resume_handle)
 				{
 					m_resume = resume_handle;
-					StartThreadpoolIo(m_io);
+					m_sqe.fd = object;
+					if constexpr (std::is_same_v<void, decltype((*this)(std::declval<io_uring_sqe &>()))>)
+						(*this)(m_sqe);
+					else if (!(*this)(m_sqe))
+						return false;
 
-					try
+					registration.set(token);
+					if (const auto error = submit())
 					{
-						return call(std::is_same<void, decltype((*this)(std::declval<OVERLAPPED &>()))>{});
-					}
-					catch (...)
-					{
-						CancelThreadpoolIo(m_io);
-						throw;
+						m_result = -error;
+						return false;
 					}
+					return true;
 				}
 
-				void call(std::true_type)
+				bool await_suspend(coro::coroutine_handle<> resume_handle)
 				{
-					(*this)(*this);
-					set_timer();
+					return await_suspend(continuation{ resume_handle });
 				}
 
-				bool call(std::false_type)
+				int submit()
 				{
-					if ((*this)(*this))
+					if (timeout.count())
 					{
-						set_timer();
-						return true;
+						m_timeout = to_timespec(timeout);
+						return m_ring->submit(m_sqe, this, &m_timeout, &cancelled);
 					}
 					else
-					{
-						CancelThreadpoolIo(m_io);
-						return false;
-					}
+						return m_ring->submit(m_sqe, this, nullptr, &cancelled);
+				}
+
+				// reports cancellation, timeout and I/O errors as values
+				expected<uint32_t> try_resume() noexcept
+				{
+					registration.reset();
+					return to_expected(m_result, cancelled.load(std::memory_order_acquire), timeout.count() != 0);
 				}
 
 				uint32_t await_resume()
 				{
-					if (m_result != NO_ERROR && m_result != ERROR_HANDLE_EOF)
-					{
-						if (m_result == ERROR_OPERATION_ABORTED)
-							m_result = ERROR_TIMEOUT;
-						throw hresult_error(HRESULT_FROM_WIN32(m_result));
-					}
+					return try_resume().value();
+				}
+			};
 
-					return static_cast<uint32_t>(InternalHigh);
+			// fills a read into a registered buffer
+			struct fixed_read
+			{
+				std::byte *address;
+				uint32_t length;
+				uint16_t index;
+				uint64_t offset;
+
+				void operator()(io_uring_sqe &sqe) const noexcept
+				{
+					sqe.opcode = IORING_OP_READ_FIXED;
+					sqe.addr = reinterpret_cast<uintptr_t>(address);
+					sqe.len = length;
+					sqe.buf_index = index;
+					sqe.off = offset;
+				}
+			};
+
+			// produces a lease on the buffer the data has been read into
+			class read_awaitable
+			{
+				buffer_lease lease;
+				awaitable<fixed_read> operation;
+
+				static fixed_read describe(const buffer_lease &lease, uint64_t offset) noexcept
+				{
+					if (!lease)
+						return {};
+					return { lease.data(), static_cast<uint32_t>(lease.capacity()), static_cast<uint16_t>(lease.index()), offset };
 				}
 
-				void on_timeout()
+			public:
+				read_awaitable(io_ring &ring, int object, buffer_pool &pool, uint64_t offset, TimeSpan timeout, cancellation_token &&token) :
+					lease{ pool.try_acquire() },
+					operation{ ring, object, describe(lease, offset), timeout, std::move(token) }
+				{}
+
+				bool await_ready() const noexcept
 				{
-					// cancel io
-					CancelIoEx(object, this);
+					return !lease;
+				}
+
+				bool await_suspend(continuation resume_handle)
+				{
+					return operation.await_suspend(resume_handle);
+				}
+
+				bool await_suspend(coro::coroutine_handle<> resume_handle)
+				{
+					return operation.await_suspend(resume_handle);
+				}
+
+				// reports std::errc::no_buffer_space when all buffers of the pool are in use
+				expected<buffer_lease> try_resume() noexcept
+				{
+					if (!lease)
+						return std::make_error_code(std::errc::no_buffer_space);
+					auto bytes = operation.try_resume();
+					if (!bytes)
+						return bytes.error();
+					lease.resize(*bytes);
+					return std::move(lease);
+				}
+
+				buffer_lease await_resume()
+				{
+					return try_resume().value();
 				}
 			};
 
-			winrt::impl::handle<io_traits> m_io;
-			HANDLE object;
+			io_ring *m_ring;
+			int object;
 
 			//
 		public:
-			resumable_io_timeout(HANDLE object) :
-				object{ object },
-				m_io{ CreateThreadpoolIo(object, my_awaitable_base::callback, nullptr, nullptr) }
+			// reads at the current file position, which is also the only valid position for pipes and sockets
+			static constexpr uint64_t current_position = ~uint64_t{};
+
+			resumable_io_timeout(int object, io_ring &ring = io_ring::get_default()) noexcept :
+				m_ring{ &ring },
+				object{ object }
+			{}
+
+			template <typename F>
+			auto start(F &&callback, TimeSpan timeout, cancellation_token token = {})
 			{
-				if (!m_io)
+				return awaitable<std::decay_t<F>>{ *m_ring, object, std::forward<F>(callback), timeout, std::move(token) };
+			}
+
+			// zero-copy read into a buffer of the pool, which must be registered with the same ring
+			auto read(buffer_pool &pool, TimeSpan timeout, uint64_t offset = current_position, cancellation_token token = {})
+			{
+				assert(&pool.ring() == m_ring);
+				return read_awaitable{ *m_ring, object, pool, offset, timeout, std::move(token) };
+			}
+
+			int get() const noexcept
+			{
+				return object;
+			}
+
+			io_ring &ring() const noexcept
+			{
+				return *m_ring;
+			}
+		};
+
+		// Batched submission of resumable_io_timeout operations
+		// add() prepares an operation with its own callback and timeout; the callback is called immediately. All operations
+		// are submitted with a single io_uring_enter when the batch is awaited, directly or as a when_all/when_any child.
+		// The batch produces std::vector<expected<uint32_t>> with the result of every operation in the order of add().
+		// An operation whose callback returns false is not submitted and produces 0.
+		class io_batch
+		{
+			struct entry : io_ring::batch_entry
+			{
+				io_batch *batch{};
+				size_t index{};
+
+				virtual void complete(int result) noexcept override
 				{
-					winrt::throw_last_error();
+					batch->complete(index, result);
 				}
+			};
+
+			struct result
+			{
+				int value;
+				bool timed;
+			};
+
+			io_ring *m_ring;
+			std::vector<entry> entries;
+			std::vector<result> results;
+			std::atomic<size_t> pending{ 0 };
+			continuation m_resume;
+			cancellation_token token;
+			std::atomic<bool> cancelled{ false };
+			cancellation_registration registration{ [](void *context) noexcept
+			{
+				static_cast<io_batch *>(context)->cancel();
+			}, this };
+
+			void complete(size_t index, int value) noexcept
+			{
+				results[index].value = value;
+				if (pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+					m_resume();
 			}
 
-			template <typename F>
-			auto start(F &&callback, winrt::Windows::Foundation::TimeSpan timeout)
+		public:
+			explicit io_batch(io_ring &ring = io_ring::get_default(), cancellation_token token = {}) :
+				m_ring{ &ring },
+				token{ std::move(token) }
+			{}
+
+			// batches are only moved before they are awaited
+			io_batch(io_batch &&o) noexcept :
+				m_ring{ o.m_ring },
+				entries{ std::move(o.entries) },
+				results{ std::move(o.results) },
+				token{ std::move(o.token) }
+			{}
+
+			// reserves space for the given number of operations
+			void reserve(size_t count)
 			{
-				return awaitable<F>{get(), object, std::forward<F>(callback), timeout};
+				entries.reserve(count);
+				results.reserve(count);
 			}
 
-			PTP_IO get() const noexcept
+			size_t size() const noexcept
 			{
-				return winrt::get_abi(m_io);
+				return results.size();
+			}
+
+			// the callback receives io_uring_sqe with fd already set and fills in the operation, as in resumable_io_timeout::start
+			template<class F>
+			io_batch &add(const resumable_io_timeout &io, F &&callback, TimeSpan timeout = {})
+			{
+				assert(&io.ring() == m_ring && "all operations of a batch must use the same io_ring");
+				entry e;
+				e.sqe.fd = io.get();
+				e.index = results.size();
+				if constexpr (std::is_same_v<void, decltype(callback(e.sqe))>)
+					callback(e.sqe);
+				else if (!callback(e.sqe))
+				{
+					results.push_back({ 0, false });
+					return *this;
+				}
+
+				if (timeout.count())
+				{
+					e.timeout = resumable_io_timeout::to_timespec(timeout);
+					e.has_timeout = true;
+				}
+				entries.push_back(e);
+				results.push_back({ 0, e.has_timeout });
+				return *this;
+			}
+
+			bool await_ready() const noexcept
+			{
+				return entries.empty();
+			}
+
+			bool await_suspend(continuation resume_handle)
+			{
+				m_resume = resume_handle;
+				for (auto &e : entries)
+					e.batch = this;
+				pending.store(entries.size(), std::memory_order_relaxed);
+
+				registration.set(token);
+				const auto submitted = m_ring->submit(entries.data(), entries.size(), &cancelled);
+				if (submitted.submitted == entries.size())
+					return true;
+
+				// operations that have not been submitted fail with the error, the others complete as usual
+				const auto failed = entries.size() - submitted.submitted;
+				for (auto i = submitted.submitted; i < entries.size(); ++i)
+					results[entries[i].index].value = -submitted.error;
+				return pending.fetch_sub(failed, std::memory_order_acq_rel) != failed;
+			}
+
+			bool await_suspend(coro::coroutine_handle<> resume_handle)
+			{
+				return await_suspend(continuation{ resume_handle });
+			}
+
+			std::vector<expected<uint32_t>> await_resume()
+			{
+				registration.reset();
+				const bool was_cancelled = cancelled.load(std::memory_order_acquire);
+				std::vector<expected<uint32_t>> values;
+				values.reserve(results.size());
+				for (const auto &r : results)
+					values.push_back(resumable_io_timeout::to_expected(r.value, was_cancelled, r.timed));
+				return values;
+			}
+
+			// cancels all operations of the batch; used by when_any for a batch that has lost the race
+			void cancel() noexcept
+			{
+				cancelled.store(true, std::memory_order_release);
+				try
+				{
+					for (auto &e : entries)
+						m_ring->cancel(&e);
+				}
+				catch (...)
+				{
+				}
 			}
 		};
+#endif
 	}
 
 	// Bring public stuff to winrt_ex namespace
 	using details::future;
 	using details::no_result;
+	using details::cancellation_source;
+	using details::cancellation_token;
+	using details::cancellation_registration;
+	using details::get_cancellation_token;
+#if defined(_WIN32)
 	using details::default_policy;
+#endif
 	using details::ex_policy;
+	using details::thread_pool;
+	using details::pool_policy;
+	using details::resume_on;
+	using details::timer_wheel;
 	using details::async_timer;
+#if defined(CPPWINRT_EX_ENABLE_TRACING)
+	using details::write_chrome_trace;
+#endif
+#if defined(CPPWINRT_EX_ENABLE_WATCHDOG)
+	using details::stall_report;
+	using details::stall_watchdog;
+#endif
+#if defined(CPPWINRT_EX_ENABLE_METRICS)
+	using details::metric;
+	using details::latency_metric;
+	using details::histogram_snapshot;
+	using details::metrics_snapshot;
+	using details::get_metrics_snapshot;
+	using details::write_prometheus;
+#endif
+#if defined(_WIN32)
+	using details::resumable_io_timeout;
+#elif defined(__linux__)
+	using details::io_ring;
 	using details::resumable_io_timeout;
+	using details::io_batch;
+	using details::buffer_pool;
+	using details::buffer_lease;
+#endif
 
 	using details::start;
 	using details::start_async;
 	using details::when_all;
 	using details::when_any;
+	using details::task_group;
 }
 
 namespace winrt_ex
@@ -1272,31 +8108,58 @@ namespace winrt_ex
 	namespace details
 	{
 		// execute_with_timeout
-		inline future<void> throwing_timer(result_type<void>, winrt::Windows::Foundation::TimeSpan timeout)
+		// when the operation wins, when_any cancels the timer and it completes immediately
+		inline future<void> throwing_timer(result_type<void>, TimeSpan timeout)
 		{
-			co_await winrt::resume_after{ timeout };
-			throw winrt::hresult_canceled{};
+			co_await resume_after{ timeout, co_await get_cancellation_token() };
+			throw_canceled();
 		}
 
+#if defined(_MSC_VER)
 #pragma warning(push)
 #pragma warning(disable:4033)
+#endif
 		template<class T>
-		inline future<std::decay_t<T>> throwing_timer(result_type<T>, winrt::Windows::Foundation::TimeSpan timeout)
+		inline future<std::decay_t<T>> throwing_timer(result_type<T>, TimeSpan timeout)
 		{
-			co_await winrt::resume_after{ timeout };
-			throw winrt::hresult_canceled{};
-			co_return std::decay_t<T> {};	// this line is unnecessary, but prevents ICE (!!!)
+			co_await resume_after{ timeout, co_await get_cancellation_token() };
+			throw_canceled();
+			if constexpr (std::is_default_constructible_v<std::decay_t<T>>)
+				co_return std::decay_t<T> {};	// this line is unnecessary, but prevents ICE (!!!)
 		}
+#if defined(_MSC_VER)
 #pragma warning(pop)
+#endif
+
+		template<class Awaitable>
+		inline auto execute_with_timeout(Awaitable &&awaitable, TimeSpan timeout)
+		{
+			const auto type = get_result_type(awaitable);
+			return when_any(std::forward<Awaitable>(awaitable), throwing_timer(type, timeout));
+		}
+
+		// non-throwing version: the timer reports the timeout as a value
+		template<class T>
+		inline future<expected<T>> expiring_timer(result_type<T>, TimeSpan timeout)
+		{
+			resume_after timer{ timeout, co_await get_cancellation_token() };
+			if (auto result = co_await try_await(timer); !result)
+				co_return result.error();
+			co_return std::make_error_code(std::errc::timed_out);
+		}
 
+		// produces std::pair<expected<T>, size_t>; neither a timeout nor a failure of the operation throws
 		template<class Awaitable>
-		inline auto execute_with_timeout(const Awaitable &awaitable, winrt::Windows::Foundation::TimeSpan timeout)
+		inline auto try_execute_with_timeout(Awaitable &&awaitable, TimeSpan timeout)
 		{
-			return when_any(awaitable, throwing_timer(get_result_type(awaitable), timeout));
+			const auto type = get_result_type(awaitable);
+			using awaitable_t = std::decay_t<Awaitable>;
+			return when_any(try_awaitable<awaitable_t>{ awaitable_t{ std::forward<Awaitable>(awaitable) } }, expiring_timer(type, timeout));
 		}
 	}
 
 	using details::execute_with_timeout;
+	using details::try_execute_with_timeout;
 }
 
 namespace winrt_ex
@@ -1307,4 +8170,15 @@ namespace winrt_ex
 	}
 
 	using details::future;
+	using details::task;
+	using details::shared_future;
+	using details::async_generator;
+	using details::for_each;
+	using details::async_channel;
+	using details::async_event;
+	using details::async_mutex;
+	using details::async_mutex_lock;
+	using details::async_semaphore;
+	using details::expected;
+	using details::try_await;
 }
\ No newline at end of file
@@ -114,29 +114,26 @@ winrt_ex::future<void> test_execute_with_timeout()
 	}
 }
 
+// timings of library primitives are measured by benchmark/suite.cpp
 template<class F>
-void measure(const wchar_t *name, const F &f)
+void run(const wchar_t *name, const F &f)
 {
 	std::wcout << L"Starting operation " << name << L" ... ";
-	auto start = std::chrono::high_resolution_clock::now();
 	f();
-	auto stop = std::chrono::high_resolution_clock::now();
-
-	auto seconds = std::chrono::duration_cast<std::chrono::duration<double>>(stop - start);
-	std::wcout << seconds.count() << L" seconds\r\n";
+	std::wcout << L"done\r\n";
 }
 
 int main()
 {
 	winrt::init_apartment();
 	{
-		measure(L"test_execute_with_timeout", [] { test_execute_with_timeout().get(); });
-		measure(L"test_async_timer", [] { test_async_timer().get(); });
-		measure(L"test_when_all_void", [] { test_when_all_void().get(); });
-		measure(L"test_when_all_bool", [] { test_when_all_bool().get(); });
-		measure(L"test_when_all_mixed", [] { test_when_all_mixed().get(); });
-		measure(L"test_when_any_void", [] { test_when_any_void().get(); });
-		measure(L"test_when_any_bool", [] {test_when_any_bool().get(); });
+		run(L"test_execute_with_timeout", [] { test_execute_with_timeout().get(); });
+		run(L"test_async_timer", [] { test_async_timer().get(); });
+		run(L"test_when_all_void", [] { test_when_all_void().get(); });
+		run(L"test_when_all_bool", [] { test_when_all_bool().get(); });
+		run(L"test_when_all_mixed", [] { test_when_all_mixed().get(); });
+		run(L"test_when_any_void", [] { test_when_any_void().get(); });
+		run(L"test_when_any_bool", [] {test_when_any_bool().get(); });
 
 		Sleep(5000);
 	}